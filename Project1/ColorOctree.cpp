@@ -0,0 +1,239 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorOctree.cpp                         Author:     Benjamin Reichert
+//
+//      Implementation of the octree color quantizer.  See ColorOctree.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ColorOctree.h"
+#include <string.h>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The tree starts as a bare root.
+//
+///////////////////////////////////////////////////////////////////////////////
+ColorOctree::ColorOctree(int colors, int levels)
+    : used(0), free_list(-1), max_colors(Max(colors, 1)),
+      depth(Max(1, Min(levels, c_maxOctreeDepth))), leaves(0), last_leaf(-1)
+{
+    for (int i = 0; i < c_maxOctreeDepth; ++i)
+        reducible[i] = -1;
+
+    root = New_Node(0);
+}// ColorOctree
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Release the arena.
+//
+///////////////////////////////////////////////////////////////////////////////
+ColorOctree::~ColorOctree()
+{
+    for (size_t i = 0; i < blocks.size(); ++i)
+        delete[] blocks[i];
+}// ~ColorOctree
+
+
+// Which child of a node on level a color goes to: the level's bit of red, green and blue.
+int ColorOctree::Child_Of(const unsigned char* rgb, int level)
+{
+    int shift = 7 - level;
+    return ((rgb[0] >> shift) & 1) << 2 | ((rgb[1] >> shift) & 1) << 1 | ((rgb[2] >> shift) & 1);
+}// Child_Of
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take a node for the given level, from the free list or the arena.
+//  Nodes on the last level are leaves; the others go on their level's
+//  reducible list.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ColorOctree::New_Node(int level)
+{
+    int node = free_list;
+
+    if (node >= 0)
+        free_list = At(node).next;
+    else
+    {
+        if (used == (int)blocks.size() * c_blockSize)
+            blocks.push_back(new Node[c_blockSize]);
+        node = used++;
+    }
+
+    Node& n = At(node);
+    memset(n.sum, 0, sizeof(n.sum));
+    n.count = 0;
+    for (int i = 0; i < 8; ++i)
+        n.children[i] = -1;
+    n.index = -1;
+    n.leaf = level == depth;
+
+    if (n.leaf)
+    {
+        ++leaves;
+        n.next = -1;
+    }
+    else
+    {
+        n.next = reducible[level];
+        reducible[level] = node;
+    }
+
+    return node;
+}// New_Node
+
+
+void ColorOctree::Free_Node(int node)
+{
+    At(node).next = free_list;
+    free_list = node;
+}// Free_Node
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fold the children of the newest node on the deepest level that has
+//  any into it.  Deeper levels hold only leaves, so its children are all
+//  leaves.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ColorOctree::Reduce()
+{
+    int level = depth - 1;
+    while (level > 0 && reducible[level] < 0)
+        --level;
+
+    int     node = reducible[level];
+    Node&   n = At(node);
+    reducible[level] = n.next;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        int child = n.children[i];
+        if (child < 0)
+            continue;
+
+        const Node& c = At(child);
+        for (int k = 0; k < 3; ++k)
+            n.sum[k] += c.sum[k];
+        n.count += c.count;
+
+        Free_Node(child);
+        n.children[i] = -1;
+        --leaves;
+    }
+
+    n.leaf = true;
+    n.next = -1;
+    ++leaves;
+
+    last_leaf = -1;
+}// Reduce
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add a row of packed rgb colors.  Runs of one color, common in real
+//  images, skip the walk down the tree.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ColorOctree::Add_Row(const unsigned char* rgb, int count)
+{
+    for (int i = 0; i < count; ++i, rgb += 3)
+    {
+        int leaf = last_leaf;
+
+        if (leaf < 0 || rgb[0] != last_rgb[0] || rgb[1] != last_rgb[1] || rgb[2] != last_rgb[2])
+        {
+            leaf = root;
+            for (int level = 0; !At(leaf).leaf; ++level)
+            {
+                int branch = Child_Of(rgb, level);
+                int child = At(leaf).children[branch];
+                if (child < 0)
+                {
+                    child = New_Node(level + 1);
+                    At(leaf).children[branch] = child;
+                }
+                leaf = child;
+            }
+        }
+
+        Node& n = At(leaf);
+        n.sum[0] += rgb[0];
+        n.sum[1] += rgb[1];
+        n.sum[2] += rgb[2];
+        ++n.count;
+
+        last_leaf = leaf;
+        memcpy(last_rgb, rgb, 3);
+
+        while (leaves > max_colors)
+            Reduce();
+    }
+}// Add_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number the leaves and make each the mean of the colors it holds.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ColorOctree::Build_Palette(vector<unsigned char>& palette)
+{
+    vector<int> stack(1, root);
+    palette.clear();
+
+    while (!stack.empty())
+    {
+        Node& n = At(stack.back());
+        stack.pop_back();
+
+        if (n.leaf)
+        {
+            n.index = (int)palette.size() / 3;
+            for (int k = 0; k < 3; ++k)
+                palette.push_back((unsigned char)(n.count ? (n.sum[k] + n.count / 2) / n.count : 0));
+            continue;
+        }
+
+        for (int i = 7; i >= 0; --i)
+            if (n.children[i] >= 0)
+                stack.push_back(n.children[i]);
+    }
+
+    return (int)palette.size() / 3;
+}// Build_Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Walk a color down to its leaf.  Every color added has a path; any
+//  other color that leaves the tree takes the first branch there is.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ColorOctree::Index_Of(const unsigned char* rgb) const
+{
+    int node = root;
+
+    for (int level = 0; !At(node).leaf; ++level)
+    {
+        const Node& n = At(node);
+        int         child = n.children[Child_Of(rgb, level)];
+
+        for (int i = 0; child < 0 && i < 8; ++i)
+            child = n.children[i];
+        node = child;
+    }
+
+    return At(node).index;
+}// Index_Of
@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorOctree.h                           Author:     Benjamin Reichert
+//
+//      Octree color quantizer.  Colors are added a row at a time in one
+//  streaming pass; each level of the tree splits the color cube on the
+//  next bit of red, green and blue, and a leaf keeps the count and sum of
+//  the colors that reached it.  Whenever there are more leaves than the
+//  palette allows, the most recently made node on the deepest level that
+//  has children absorbs them and becomes a leaf, so the tree never holds
+//  more than a few nodes per palette color however large the image is.
+//
+//  Nodes come from an arena of fixed size blocks and are addressed by
+//  index; nodes freed by a reduction are reused before the arena grows.
+//  The depth is the quality knob: each level below the root keeps one
+//  more bit of each primary, and a shallower tree costs fewer steps per
+//  pixel.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COLOR_OCTREE_H_
+#define _COLOR_OCTREE_H_
+
+#include <vector>
+
+const int c_maxOctreeDepth  = 8;            // levels below the root, one per bit of a primary
+const int c_maxOctreeColors = 65536;        // largest palette the octree builds
+
+class ColorOctree
+{
+    // methods
+    public:
+        ColorOctree(int max_colors, int depth = c_maxOctreeDepth);
+        ~ColorOctree();
+
+        void Add_Row(const unsigned char* rgb, int count);          // add packed rgb colors
+
+        // fix the palette, one color per leaf, and return how many there are
+        int Build_Palette(std::vector<unsigned char>& palette);
+
+        // palette index of the leaf a color added before falls in, after Build_Palette
+        int Index_Of(const unsigned char* rgb) const;
+
+        int Leaf_Count() const { return leaves; }
+
+    private:
+        struct Node
+        {
+            unsigned long long  sum[3];             // of the colors that stopped here
+            unsigned int        count;
+            int                 children[8];        // node indices, -1 for none
+            int                 next;               // next reducible node on this level, or next free node
+            int                 index;              // palette index of a leaf
+            bool                leaf;
+        };
+
+        int     New_Node(int level);
+        void    Free_Node(int node);
+        void    Reduce();
+
+        Node&       At(int node)        { return blocks[node >> c_blockShift][node & (c_blockSize - 1)]; }
+        const Node& At(int node) const  { return blocks[node >> c_blockShift][node & (c_blockSize - 1)]; }
+
+        static int Child_Of(const unsigned char* rgb, int level);
+
+        ColorOctree(const ColorOctree&);
+        ColorOctree& operator =(const ColorOctree&);
+
+    // members
+    private:
+        static const int    c_blockShift = 12;
+        static const int    c_blockSize = 1 << c_blockShift;    // nodes per arena block
+
+        std::vector<Node*>  blocks;             // the arena
+        int                 used;               // nodes handed out of the arena
+        int                 free_list;          // freed nodes to reuse, linked by next
+
+        int                 max_colors;
+        int                 depth;
+        int                 leaves;
+        int                 root;
+        int                 reducible[c_maxOctreeDepth];    // nodes with children, newest first, per level
+
+        int                 last_leaf;          // leaf the previous color went to, -1 after a reduction
+        unsigned char       last_rgb[3];
+};
+
+
+#endif
@@ -0,0 +1,929 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.cpp                         Author:     Benjamin Reichert
+//
+//      Implementation of the fixed-point convolution engine.  See
+//  Convolution.h for an overview.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Convolution.h"
+#include "Fft.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex>
+#include <algorithm>
+
+using namespace std;
+
+// constants
+const int       c_maxDivisor        = 32768;        // largest divisor searched for when making taps integer
+const int       c_channels          = 3;            // channels that get filtered (alpha is left alone)
+const double    c_tapTolerance      = 1e-6;         // how close weight * divisor must be to an integer
+const double    c_gaussianMargin    = 6.0;          // recursive Gaussian start up margin, in sigmas
+const int       c_gaussianChunk     = 64;           // fewest output rows the recursive Gaussian buffers at once
+const int       c_gaussianBlock     = 8;            // recursive Gaussian rows are padded to a multiple of this many floats
+const int       c_gaussianLines     = 8;            // rows it filters side by side, 3 * this is a multiple of c_gaussianBlock
+const int       c_gaussianStrip     = 256;          // floats across a strip of its vertical pass, a multiple of c_gaussianBlock
+const int       c_fftSize           = 256;          // transform length the FFT convolution aims for on each axis
+
+
+// Greatest common divisor of two non-negative integers
+static int Gcd(int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}// Gcd
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Convert the weights to integer taps and check whether
+//  the kernel can be split into a row and a column pass.
+//
+///////////////////////////////////////////////////////////////////////////////
+ConvolutionKernel::ConvolutionKernel(int n, const double* weights)
+    : size(n), radius(n / 2), divisor(1), separable(false), taps(n * n, 0)
+{
+    Find_Divisor(weights);
+    Find_Factors();
+}// ConvolutionKernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Build the separable kernel factor x factor over the given
+//  divisor, for kernels already known in integers like the binomials.
+//
+///////////////////////////////////////////////////////////////////////////////
+ConvolutionKernel::ConvolutionKernel(const vector<int>& factor, int d)
+    : size((int)factor.size()), radius((int)factor.size() / 2), divisor(d), separable(true),
+      taps(factor.size() * factor.size()), row(factor), column(factor)
+{
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            taps[i * size + j] = factor[i] * factor[j];
+}// ConvolutionKernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the smallest divisor that turns every weight into an integer.
+//  All of our kernels are rationals over 25, 81 or 256 so this is exact for
+//  them; anything else is approximated in 1/c_maxDivisor steps.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConvolutionKernel::Find_Divisor(const double* weights)
+{
+    int count = size * size;
+
+    divisor = c_maxDivisor;
+    for (int d = 1; d <= c_maxDivisor; ++d)
+    {
+        int i;
+        for (i = 0; i < count; ++i)
+        {
+            double scaled = weights[i] * d;
+            if (fabs(scaled - floor(scaled + 0.5)) > c_tapTolerance * Max(1.0, fabs(scaled)))
+                break;
+        }
+        if (i == count)
+        {
+            divisor = d;
+            break;
+        }
+    }
+
+    for (int i = 0; i < count; ++i)
+        taps[i] = (int)floor(weights[i] * divisor + 0.5);
+}// Find_Divisor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The kernel is separable if it is the outer product of two integer
+//  vectors.  Take the first non-zero row divided by the gcd of its entries
+//  as the row factor, then every other row must be an integer multiple of it.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConvolutionKernel::Find_Factors()
+{
+    int pivot = -1;
+    for (int i = 0; i < size && pivot < 0; ++i)
+        for (int j = 0; j < size; ++j)
+            if (taps[i * size + j])
+            {
+                pivot = i;
+                break;
+            }
+
+    if (pivot < 0)
+        return;
+
+    int g = 0;
+    int lead = 0;
+    for (int j = 0; j < size; ++j)
+    {
+        g = Gcd(g, abs(taps[pivot * size + j]));
+        if (!lead && taps[pivot * size + j])
+            lead = j + 1;
+    }
+    --lead;
+
+    row.resize(size);
+    column.resize(size);
+    for (int j = 0; j < size; ++j)
+        row[j] = taps[pivot * size + j] / g;
+
+    for (int i = 0; i < size; ++i)
+    {
+        int t = taps[i * size + lead];
+        if (t % row[lead])
+            return;
+        column[i] = t / row[lead];
+
+        for (int j = 0; j < size; ++j)
+            if (taps[i * size + j] != column[i] * row[j])
+                return;
+    }
+
+    separable = true;
+}// Find_Factors
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Reflect an index about the border.  Loops so that kernels wider than
+//  the image still land inside it.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Reflect_Index(int i, int n)
+{
+    if (n == 1)
+        return 0;
+
+    while (i < 0 || i >= n)
+    {
+        if (i < 0)
+            i = -i;
+        if (i >= n)
+            i = 2 * n - 2 - i;
+    }
+    return i;
+}// Reflect_Index
+
+
+// Divide by the kernel divisor rounding down, the same as truncating the
+// exact rational result, and clamp to a byte.  0 < acc < 256 * divisor when
+// we divide, so a reciprocal with 8 + 2 * log2(divisor) fraction bits is
+// exact, and fits 64 bits for divisors up to 2^22, the largest box included.
+struct FloorDivider
+{
+    FloorDivider(int d) : limit(256 * d), shift(8)
+    {
+        for (int bits = 1; bits < d; bits *= 2)
+            shift += 2;
+        reciprocal = ((unsigned long long)1 << shift) / d + 1;
+    }
+
+    unsigned char operator ()(int acc) const
+    {
+        if (acc <= 0)
+            return 0;
+        if (acc >= limit)
+            return 255;
+        return (unsigned char)(((unsigned long long)acc * reciprocal) >> shift);
+    }
+
+    int                 limit;
+    int                 shift;
+    unsigned long long  reciprocal;
+};
+
+
+// Copy source row y into a buffer padded by the kernel radius on both sides,
+// reflecting columns about the border.
+static void Pad_Row(const unsigned char* src, unsigned char* padded, const int* columns, int width, int radius, int y)
+{
+    const unsigned char* in = src + y * width * 4;
+    for (int x = 0; x < width + 2 * radius; ++x)
+    {
+        const unsigned char* p = in + columns[x] * 4;
+        padded[x * 4]     = p[0];
+        padded[x * 4 + 1] = p[1];
+        padded[x * 4 + 2] = p[2];
+    }
+}// Pad_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve output rows [y_begin, y_end).  Source rows are prepared once
+//  each into a ring of 2 * radius + 1 slots: for a separable kernel a slot
+//  holds the horizontally filtered row, otherwise the padded source row.
+//  Every row a window needs lies within radius of the output row, so slot
+//  row % ring size never collides inside one window.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Convolve_Rows(const ConvolutionKernel& kernel, const unsigned char* src, unsigned char* dst,
+                   int width, int height, int y_begin, int y_end)
+{
+    const int   radius      = kernel.radius;
+    const int   size        = kernel.size;
+    const int   ring_size   = size;
+    const int   padded_w    = width + 2 * radius;
+
+    vector<int> columns(padded_w);
+    for (int x = 0; x < padded_w; ++x)
+        columns[x] = Reflect_Index(x - radius, width);
+
+    vector<int>             slot_row(ring_size, -1);
+    vector<const int*>      h_window(size);
+    vector<const unsigned char*> p_window(size);
+    FloorDivider            divide(kernel.divisor);
+
+    if (kernel.Is_Separable())
+    {
+        vector<unsigned char>   padded(padded_w * 4);
+        vector<int>             ring(ring_size * width * c_channels);
+        vector<int>             acc(width * c_channels);
+        const int*              row = &kernel.row[0];
+        const int*              column = &kernel.column[0];
+
+        for (int y = y_begin; y < y_end; ++y)
+        {
+            // make sure the horizontal pass of every row in the window is done
+            for (int i = 0; i < size; ++i)
+            {
+                int s = Reflect_Index(y + i - radius, height);
+                int slot = s % ring_size;
+                int* h = &ring[slot * width * c_channels];
+
+                if (slot_row[slot] != s)
+                {
+                    Pad_Row(src, &padded[0], &columns[0], width, radius, s);
+                    for (int x = 0; x < width; ++x)
+                    {
+                        const unsigned char* p = &padded[x * 4];
+                        int r = 0, g = 0, b = 0;
+                        for (int j = 0; j < size; ++j, p += 4)
+                        {
+                            r += row[j] * p[0];
+                            g += row[j] * p[1];
+                            b += row[j] * p[2];
+                        }
+                        h[x * 3]     = r;
+                        h[x * 3 + 1] = g;
+                        h[x * 3 + 2] = b;
+                    }
+                    slot_row[slot] = s;
+                }
+                h_window[i] = h;
+            }
+
+            // vertical pass
+            for (int x = 0; x < width * c_channels; ++x)
+                acc[x] = column[0] * h_window[0][x];
+            for (int i = 1; i < size; ++i)
+            {
+                const int* h = h_window[i];
+                int c = column[i];
+                for (int x = 0; x < width * c_channels; ++x)
+                    acc[x] += c * h[x];
+            }
+
+            unsigned char* out = dst + y * width * 4;
+            for (int x = 0; x < width; ++x)
+            {
+                out[x * 4]     = divide(acc[x * 3]);
+                out[x * 4 + 1] = divide(acc[x * 3 + 1]);
+                out[x * 4 + 2] = divide(acc[x * 3 + 2]);
+            }
+        }
+    }
+    else
+    {
+        vector<unsigned char>   ring(ring_size * padded_w * 4);
+        const int*              taps = &kernel.taps[0];
+
+        for (int y = y_begin; y < y_end; ++y)
+        {
+            for (int i = 0; i < size; ++i)
+            {
+                int s = Reflect_Index(y + i - radius, height);
+                int slot = s % ring_size;
+                unsigned char* p = &ring[slot * padded_w * 4];
+
+                if (slot_row[slot] != s)
+                {
+                    Pad_Row(src, p, &columns[0], width, radius, s);
+                    slot_row[slot] = s;
+                }
+                p_window[i] = p;
+            }
+
+            unsigned char* out = dst + y * width * 4;
+            for (int x = 0; x < width; ++x)
+            {
+                int r = 0, g = 0, b = 0;
+                for (int i = 0; i < size; ++i)
+                {
+                    const unsigned char* p = p_window[i] + x * 4;
+                    const int* t = taps + i * size;
+                    for (int j = 0; j < size; ++j, p += 4)
+                    {
+                        r += t[j] * p[0];
+                        g += t[j] * p[1];
+                        b += t[j] * p[2];
+                    }
+                }
+                out[x * 4]     = divide(r);
+                out[x * 4 + 1] = divide(g);
+                out[x * 4 + 2] = divide(b);
+            }
+        }
+    }
+}// Convolve_Rows
+
+
+// Horizontal box sums of source row s into sums, three ints per pixel.
+// enter[x] and leave[x] are the reflected columns that join and drop out of
+// the window when it moves from x to x + 1.
+static void Box_Row(const unsigned char* src, int* sums, const int* enter, const int* leave,
+                    int width, int radius, int s)
+{
+    const unsigned char* in = src + s * width * 4;
+
+    int r = 0, g = 0, b = 0;
+    for (int j = -radius; j <= radius; ++j)
+    {
+        const unsigned char* p = in + Reflect_Index(j, width) * 4;
+        r += p[0];
+        g += p[1];
+        b += p[2];
+    }
+
+    for (int x = 0; x < width; ++x)
+    {
+        sums[x * 3]     = r;
+        sums[x * 3 + 1] = g;
+        sums[x * 3 + 2] = b;
+
+        const unsigned char* add = in + enter[x] * 4;
+        const unsigned char* sub = in + leave[x] * 4;
+        r += add[0] - sub[0];
+        g += add[1] - sub[1];
+        b += add[2] - sub[2];
+    }
+}// Box_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box blur output rows [y_begin, y_end) with running sums.  The column
+//  sums of the first row cost 2 * radius + 1 row passes; after that each row
+//  adds the horizontal sums of the row entering the window and subtracts
+//  those of the row leaving it, so the cost per pixel does not depend on the
+//  radius.  Rows are recomputed rather than kept, which keeps memory to a
+//  few rows however wide the window is.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Box_Blur_Rows(int radius, const unsigned char* src, unsigned char* dst,
+                   int width, int height, int y_begin, int y_end)
+{
+    const int   size    = 2 * radius + 1;
+
+    vector<int> enter(width), leave(width);
+    for (int x = 0; x < width; ++x)
+    {
+        enter[x] = Reflect_Index(x + radius + 1, width);
+        leave[x] = Reflect_Index(x - radius, width);
+    }
+
+    vector<int>     sums(width * c_channels);
+    vector<int>     acc(width * c_channels, 0);
+    FloorDivider    divide(size * size);
+
+    for (int i = -radius; i <= radius; ++i)
+    {
+        Box_Row(src, &sums[0], &enter[0], &leave[0], width, radius, Reflect_Index(y_begin + i, height));
+        for (int x = 0; x < width * c_channels; ++x)
+            acc[x] += sums[x];
+    }
+
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        unsigned char* out = dst + y * width * 4;
+        for (int x = 0; x < width; ++x)
+        {
+            out[x * 4]     = divide(acc[x * 3]);
+            out[x * 4 + 1] = divide(acc[x * 3 + 1]);
+            out[x * 4 + 2] = divide(acc[x * 3 + 2]);
+        }
+
+        if (y + 1 == y_end)
+            break;
+
+        Box_Row(src, &sums[0], &enter[0], &leave[0], width, radius, Reflect_Index(y + radius + 1, height));
+        for (int x = 0; x < width * c_channels; ++x)
+            acc[x] += sums[x];
+        Box_Row(src, &sums[0], &enter[0], &leave[0], width, radius, Reflect_Index(y - radius, height));
+        for (int x = 0; x < width * c_channels; ++x)
+            acc[x] -= sums[x];
+    }
+}// Box_Blur_Rows
+
+
+// Deriche's fourth order recursive Gaussian.  Deriche fits the Gaussian as
+// a sum of four exponentials over complex poles, so each half of it is four
+// first order recursions,
+//     w+[n] = a[k] x[n]   + p[k] w+[n-1]      causal, left to right
+//     w-[n] = b[k] x[n+1] + p[k] w-[n+1]      anticausal, right to left
+// and the output is the sum of all eight, scaled so a flat area stays flat.
+// The poles come in conjugate pairs and the input is real, so only one of
+// each pair is run and the real parts doubled.  Run this way rather than as
+// one fourth order polynomial, float rounding does not build up as sigma
+// grows, and each recursion's start can be solved for on its own.
+struct RecursiveGaussian
+{
+    RecursiveGaussian(double sigma)
+    {
+        const complex<double> alpha[4]  = { complex<double>(0.84, 1.8675), complex<double>(0.84, -1.8675),
+                                            complex<double>(-0.34015, -0.1299), complex<double>(-0.34015, 0.1299) };
+        const complex<double> lambda[4] = { complex<double>(1.783, 0.6318), complex<double>(1.783, -0.6318),
+                                            complex<double>(1.723, 1.997), complex<double>(1.723, -1.997) };
+
+        complex<double> p[4];
+        double gain = 0.0;
+        for (int k = 0; k < 4; ++k)
+        {
+            double decay = exp(-lambda[k].real() / sigma);
+            p[k] = complex<double>(decay * cos(lambda[k].imag() / sigma), -decay * sin(lambda[k].imag() / sigma));
+            gain += (alpha[k] * (1.0 + p[k]) / (1.0 - p[k])).real();
+        }
+
+        for (int m = 0; m < 2; ++m)
+        {
+            complex<double> a = 2.0 * alpha[2 * m] / gain;
+            complex<double> b = a * p[2 * m];
+
+            pole[m] = p[2 * m];
+            causal_start[m] = a / (1.0 - pole[m]);
+            anticausal_start[m] = b / (1.0 - pole[m]);
+
+            causal[4 * m]     = (float)a.real();
+            causal[4 * m + 1] = (float)a.imag();
+            anticausal[4 * m]     = (float)b.real();
+            anticausal[4 * m + 1] = (float)b.imag();
+            causal[4 * m + 2] = anticausal[4 * m + 2] = (float)pole[m].real();
+            causal[4 * m + 3] = anticausal[4 * m + 3] = (float)pole[m].imag();
+        }
+    }
+
+    float           causal[8];              // a and p of each recursion run, as real and imaginary parts
+    float           anticausal[8];          // b and p of each recursion run
+    complex<double> pole[2];                // p of each recursion run
+    complex<double> causal_start[2];        // w+ of a flat line, per unit of input
+    complex<double> anticausal_start[2];    // w- of a flat line, per unit of input
+};
+
+
+// One row of a recursive half.  Every float of the row is its own line, and
+// each line's two recursions take a step on its input x.  state holds them a
+// block of c_gaussianBlock lines at a time, real and imaginary parts of the
+// first then of the second, so every access is a fixed offset into the
+// block, which is what lets the compiler vectorize this.  The sum of the
+// real parts goes to out, or with add is added to it; out may be null.
+static void Gaussian_Row(const float* t, const float* x, float* __restrict state, float* __restrict out,
+                         bool add, int length)
+{
+    const int n = c_gaussianBlock;
+
+    for (int b = 0; b < length; b += n)
+    {
+        float* s = state + 4 * b;
+        for (int i = 0; i < n; ++i)
+        {
+            float r0 = t[0] * x[b + i] + t[2] * s[i] - t[3] * s[n + i];
+            float i0 = t[1] * x[b + i] + t[3] * s[i] + t[2] * s[n + i];
+            float r1 = t[4] * x[b + i] + t[6] * s[2 * n + i] - t[7] * s[3 * n + i];
+            float i1 = t[5] * x[b + i] + t[7] * s[2 * n + i] + t[6] * s[3 * n + i];
+            s[i] = r0;
+            s[n + i] = i0;
+            s[2 * n + i] = r1;
+            s[3 * n + i] = i1;
+        }
+
+        if (out && add)
+            for (int i = b; i < b + n; ++i)
+                out[i] += s[i - b] + s[2 * n + i - b];
+        else if (out)
+            for (int i = b; i < b + n; ++i)
+                out[i] = s[i - b] + s[2 * n + i - b];
+    }
+}// Gaussian_Row
+
+
+// Set every line's recursions to start times that line's x.
+static void Gaussian_Start(const complex<double>* start, const float* x, float* state, int length)
+{
+    const int n = c_gaussianBlock;
+
+    for (int b = 0; b < length; b += n)
+        for (int i = 0; i < n; ++i)
+            for (int m = 0; m < 2; ++m)
+            {
+                state[4 * b + 2 * m * n + i]     = (float)start[m].real() * x[b + i];
+                state[4 * b + 2 * m * n + n + i] = (float)start[m].imag() * x[b + i];
+            }
+}// Gaussian_Start
+
+
+// A recursion run from zero over one period of a periodic line, by then
+// holding s, only has to be divided by 1 - p ^ period to hold what it would
+// had it run forever.
+static void Gaussian_Periodic(const complex<double>* pole, int period, float* state, int length)
+{
+    const int n = c_gaussianBlock;
+
+    for (int m = 0; m < 2; ++m)
+    {
+        const complex<double> f = 1.0 / (1.0 - pow(pole[m], period));
+        const float fr = (float)f.real(), fi = (float)f.imag();
+
+        for (int b = 0; b < length; b += n)
+            for (int i = 0; i < n; ++i)
+            {
+                float* s = state + 4 * b + 2 * m * n + i;
+                float re = s[0], im = s[n];
+                s[0] = fr * re - fi * im;
+                s[n] = fi * re + fr * im;
+            }
+    }
+}// Gaussian_Periodic
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the recursive Gaussian down count rows of length floats and put
+//  rows [first, first + out) of the result into y.  Row r of the input is
+//  x + rows[r] * pitch, so reflected margins need not be copied, and y rows
+//  are pitch floats apart.  With no period each half starts as if the lines
+//  carried on with their end values, and first and the rows after the
+//  output have to cover its start up.  Otherwise the input repeats every
+//  period rows and each half starts exactly from the period before it,
+//  which first and the rows after the output have to cover, plus one.
+//  scratch holds 4 * length floats.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Gaussian_Columns(const RecursiveGaussian& g, const float* x, const int* rows, float* y, float* scratch,
+                             int count, int first, int out, int length, int pitch, int period)
+{
+    const int last = first + out;
+
+    if (period)
+    {
+        memset(scratch, 0, 4 * length * sizeof(float));
+        for (int r = first - period; r < first; ++r)
+            Gaussian_Row(g.causal, x + rows[r] * pitch, scratch, 0, false, length);
+        Gaussian_Periodic(g.pole, period, scratch, length);
+    }
+    else
+    {
+        Gaussian_Start(g.causal_start, x + rows[0] * pitch, scratch, length);
+        for (int r = 0; r < first; ++r)
+            Gaussian_Row(g.causal, x + rows[r] * pitch, scratch, 0, false, length);
+    }
+
+    for (int r = first; r < last; ++r)
+        Gaussian_Row(g.causal, x + rows[r] * pitch, scratch, y + (r - first) * pitch, false, length);
+
+    if (period)
+    {
+        memset(scratch, 0, 4 * length * sizeof(float));
+        for (int r = last + period - 1; r >= last; --r)
+            Gaussian_Row(g.anticausal, x + rows[r + 1] * pitch, scratch, 0, false, length);
+        Gaussian_Periodic(g.pole, period, scratch, length);
+    }
+    else
+    {
+        Gaussian_Start(g.anticausal_start, x + rows[count - 1] * pitch, scratch, length);
+        for (int r = count - 1; r >= last; --r)
+            Gaussian_Row(g.anticausal, x + rows[Min(r + 1, count - 1)] * pitch, scratch, 0, false, length);
+    }
+
+    for (int r = last - 1; r >= first; --r)
+        Gaussian_Row(g.anticausal, x + rows[Min(r + 1, count - 1)] * pitch, scratch, y + (r - first) * pitch, true, length);
+}// Gaussian_Columns
+
+
+// Period of a line of n samples reflected about both ends.
+static int Reflected_Period(int n)
+{
+    return 2 * (n - 1);
+}// Reflected_Period
+
+
+int Recursive_Gaussian_Margin(double sigma, int n)
+{
+    const int margin = (int)ceil(c_gaussianMargin * sigma);
+    const int period = Reflected_Period(n);
+
+    return margin < period ? margin : period ? period + 1 : 0;
+}// Recursive_Gaussian_Margin
+
+
+int Recursive_Gaussian_Chunk(double sigma, int height)
+{
+    return Max(c_gaussianChunk, 4 * Recursive_Gaussian_Margin(sigma, height));
+}// Recursive_Gaussian_Chunk
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Recursive Gaussian over output rows [y_begin, y_end).  The source rows
+//  of the band and of a margin above and below are filtered horizontally,
+//  each line run through a margin of reflected columns, into a float buffer.
+//  The vertical pass then runs down and up that buffer a whole row at a
+//  time, through the margin rows reflected back into it, and the margins
+//  absorb the start up of both halves so the borders come out reflected like
+//  the other filters.  A margin never goes further than once round the
+//  reflected image, where it instead holds the period the start is solved
+//  from, so the work and the buffers stop growing with sigma there.  Tall
+//  bands are done in chunks, each with its own margin.  Chunks always start
+//  at multiples of Recursive_Gaussian_Chunk rows from the top of the image
+//  and are filtered whole, so a row comes out the same however the image
+//  is cut into bands.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Recursive_Gaussian_Rows(double sigma, const unsigned char* src, unsigned char* dst,
+                             int width, int height, int y_begin, int y_end)
+{
+    const RecursiveGaussian g(sigma);
+    const int   margin_x    = Recursive_Gaussian_Margin(sigma, width);
+    const int   margin      = Recursive_Gaussian_Margin(sigma, height);
+    const int   period_x    = margin_x > Reflected_Period(width) ? Reflected_Period(width) : 0;
+    const int   period      = margin > Reflected_Period(height) ? Reflected_Period(height) : 0;
+    const int   padded_w    = width + 2 * margin_x;
+    const int   stride      = width * c_channels;
+    const int   pitch       = (stride + c_gaussianBlock - 1) / c_gaussianBlock * c_gaussianBlock;
+    const int   group       = c_gaussianLines * c_channels;
+    const int   chunk_rows  = Recursive_Gaussian_Chunk(sigma, height);
+    const int   max_rows    = Min(chunk_rows + 2 * margin, height);
+
+    vector<int>     columns(padded_w);
+    for (int x = 0; x < padded_w; ++x)
+        columns[x] = Reflect_Index(x - margin_x, width);
+
+    vector<int>     rows(Min(chunk_rows, height) + 2 * margin);
+    vector<float>   lines(width * group);
+    vector<float>   filtered(width * group);
+    vector<float>   band(max_rows * pitch);
+    vector<float>   blurred(Min(chunk_rows, height) * pitch);
+    vector<float>   scratch(4 * Max(c_gaussianStrip, group));
+
+    // a chunk at a time rather than the whole band; with the margins capped
+    // the float buffers are never much bigger than the image
+    for (int chunk_begin = y_begin / chunk_rows * chunk_rows; chunk_begin < y_end; chunk_begin += chunk_rows)
+    {
+        const int   chunk_end   = Min(chunk_begin + chunk_rows, height);
+        const int   kept        = chunk_end - chunk_begin;
+        const int   count       = kept + 2 * margin;
+
+        // the margin rows reflect back into the source rows [top, bottom)
+        const int   top         = Max(chunk_begin - margin, 0);
+        const int   bottom      = Min(chunk_end + margin, height);
+
+        for (int r = 0; r < count; ++r)
+            rows[r] = Reflect_Index(chunk_begin - margin + r, height) - top;
+
+        // horizontal pass, c_gaussianLines rows at a time laid side by side
+        // so each column of the group becomes one row for Gaussian_Columns.
+        // A last short group filters whatever the unused lanes last held
+        for (int r = top; r < bottom; r += c_gaussianLines)
+        {
+            const int n = Min(c_gaussianLines, bottom - r);
+
+            for (int l = 0; l < n; ++l)
+            {
+                const unsigned char* in = src + (r + l) * width * 4;
+                float* out = &lines[l * c_channels];
+                for (int x = 0; x < width; ++x, in += 4, out += group)
+                {
+                    out[0] = in[0];
+                    out[1] = in[1];
+                    out[2] = in[2];
+                }
+            }
+
+            Gaussian_Columns(g, &lines[0], &columns[0], &filtered[0], &scratch[0],
+                             padded_w, margin_x, width, group, group, period_x);
+
+            for (int l = 0; l < n; ++l)
+            {
+                const float* in = &filtered[l * c_channels];
+                float* out = &band[(r - top + l) * pitch];
+                for (int x = 0; x < width; ++x, in += group)
+                {
+                    out[x * 3]     = in[0];
+                    out[x * 3 + 1] = in[1];
+                    out[x * 3 + 2] = in[2];
+                }
+            }
+        }
+
+        // vertical pass, in strips narrow enough that the rows of a strip
+        // stay in cache while the recursion goes down and back up them
+        for (int i = 0; i < pitch; i += c_gaussianStrip)
+            Gaussian_Columns(g, &band[i], &rows[0], &blurred[i], &scratch[0],
+                             count, margin, kept, Min(c_gaussianStrip, pitch - i), pitch, period);
+
+        for (int y = Max(chunk_begin, y_begin); y < Min(chunk_end, y_end); ++y)
+        {
+            const float* in = &blurred[(y - chunk_begin) * pitch];
+            unsigned char* out = dst + y * width * 4;
+            for (int x = 0; x < width; ++x)
+                for (int c = 0; c < 3; ++c)
+                {
+                    float v = in[x * 3 + c] + 0.5f;
+                    out[x * 4 + c] = v <= 0.0f ? 0 : v >= 255.0f ? 255 : (unsigned char)v;
+                }
+        }
+    }
+}// Recursive_Gaussian_Rows
+
+
+// Transform length for a kernel.  A transform holds an input tile plus the
+// kernel's spread, so aim for c_fftSize but at least twice the spread.
+static int Fft_Length(const ConvolutionKernel& kernel)
+{
+    return Fft::Fast_Size(Max(c_fftSize, 2 * (kernel.size - 1)));
+}// Fft_Length
+
+
+// Rows in one tile of Fft_Convolve_Rows.
+int Fft_Tile_Rows(const ConvolutionKernel& kernel)
+{
+    return Fft_Length(kernel) - kernel.size + 1;
+}// Fft_Tile_Rows
+
+
+// Forward 2-D transform of a rows x fft_w array whose rows past used_rows
+// are zero: the rows first, skipping the zero ones, then the columns.
+static void Forward_2D(const Fft& row_fft, const Fft& column_fft, complex<double>* data,
+                       complex<double>* work, int used_rows)
+{
+    const int fft_w = row_fft.Size();
+
+    for (int i = 0; i < used_rows; ++i)
+        row_fft.Forward(data + i * fft_w, work);
+    column_fft.Forward(data, work, fft_w);
+}// Forward_2D
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve output rows [y_begin, y_end) with overlap-add.  The reflected
+//  source rows the band reads are cut into tiles that leave room in the
+//  transform for the kernel to spread; each tile is transformed, multiplied
+//  by the kernel spectrum, transformed back and added into a strip of
+//  accumulators one tile tall plus the kernel.  Once a row of tiles is done
+//  the top of the strip is final, goes out, and the strip moves down, so
+//  memory stays at a few tiles however large the image.
+//
+//  The kernel is real, so two channel tiles ride in one transform as the
+//  real and imaginary parts.  The inverse is the forward transform of the
+//  conjugate.  Taps and pixels are integers, so each sum is rounded back to
+//  the integer Convolve_Rows computes before the same division.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Fft_Convolve_Rows(const ConvolutionKernel& kernel, const unsigned char* src, unsigned char* dst,
+                       int width, int height, int y_begin, int y_end)
+{
+    const int   size        = kernel.size;
+    const int   radius      = kernel.radius;
+    const int   padded_w    = width + 2 * radius;
+    const int   padded_h    = y_end - y_begin + 2 * radius;
+
+    // no bigger a transform than the band needs
+    int fft_w = Fft_Length(kernel);
+    if (fft_w - size + 1 > padded_w)
+        fft_w = Fft::Fast_Size(padded_w + size - 1);
+    int fft_h = Fft_Length(kernel);
+    if (fft_h - size + 1 > padded_h)
+        fft_h = Fft::Fast_Size(padded_h + size - 1);
+
+    const int   tile_w      = fft_w - size + 1;
+    const int   tile_h      = fft_h - size + 1;
+    const int   area        = fft_w * fft_h;
+    const int   acc_w       = padded_w + size - 1;
+    const int   acc_size    = fft_h * acc_w;
+    const int   planes      = (padded_w + tile_w - 1) / tile_w * c_channels;
+
+    Fft                         row_fft(fft_w), column_fft(fft_h);
+    vector<complex<double> >    spectrum(area), tile(area), work(area);
+    vector<double>              acc(c_channels * acc_size, 0.0);
+    FloorDivider                divide(kernel.divisor);
+
+    // the filters correlate, so transform the kernel flipped
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            spectrum[i * fft_w + j] = kernel.taps[(size - 1 - i) * size + size - 1 - j];
+    Forward_2D(row_fft, column_fft, &spectrum[0], &work[0], size);
+
+    vector<int> columns(padded_w);
+    for (int x = 0; x < padded_w; ++x)
+        columns[x] = Reflect_Index(x - radius, width);
+
+    for (int top = 0; top < padded_h; top += tile_h)
+    {
+        const int rows = Min(tile_h, padded_h - top);
+
+        for (int plane = 0; plane < planes; plane += 2)
+        {
+            int count = Min(2, planes - plane);
+
+            fill(tile.begin(), tile.end(), complex<double>(0.0, 0.0));
+            for (int k = 0; k < count; ++k)
+            {
+                int left = (plane + k) / c_channels * tile_w;
+                int channel = (plane + k) % c_channels;
+                int cols = Min(tile_w, padded_w - left);
+
+                for (int i = 0; i < rows; ++i)
+                {
+                    const unsigned char* in = src + Reflect_Index(y_begin + top + i - radius, height) * width * 4 + channel;
+                    complex<double>* out = &tile[i * fft_w];
+                    for (int j = 0; j < cols; ++j)
+                    {
+                        if (k)
+                            out[j] = complex<double>(out[j].real(), in[columns[left + j] * 4]);
+                        else
+                            out[j] = in[columns[left + j] * 4];
+                    }
+                }
+            }
+
+            Forward_2D(row_fft, column_fft, &tile[0], &work[0], rows);
+            for (int i = 0; i < area; ++i)
+            {
+                const complex<double>& a = tile[i];
+                const complex<double>& b = spectrum[i];
+                tile[i] = complex<double>(a.real() * b.real() - a.imag() * b.imag(),
+                                          -(a.real() * b.imag() + a.imag() * b.real()));
+            }
+            column_fft.Forward(&tile[0], &work[0], fft_w);
+            for (int i = 0; i < rows + size - 1; ++i)
+                row_fft.Forward(&tile[i * fft_w], &work[0]);
+
+            // undo the conjugate and the transform's scale while adding
+            for (int k = 0; k < count; ++k)
+            {
+                int left = (plane + k) / c_channels * tile_w;
+                int channel = (plane + k) % c_channels;
+                int cols = Min(tile_w, padded_w - left) + size - 1;
+                double scale = k ? -1.0 / area : 1.0 / area;
+
+                for (int i = 0; i < rows + size - 1; ++i)
+                {
+                    const complex<double>* in = &tile[i * fft_w];
+                    double* out = &acc[channel * acc_size + i * acc_w + left];
+                    for (int j = 0; j < cols; ++j)
+                        out[j] += scale * (k ? in[j].imag() : in[j].real());
+                }
+            }
+        }
+
+        // accumulator row i now has every source row it needs; output row
+        // y reads source rows y through y + 2 * radius, so it sits at y + 2 * radius
+        for (int i = 0; i < rows; ++i)
+        {
+            int y = top + i - 2 * radius;
+            if (y < 0)
+                continue;
+
+            unsigned char* out = dst + (y_begin + y) * width * 4;
+            for (int c = 0; c < c_channels; ++c)
+            {
+                const double* in = &acc[c * acc_size + i * acc_w + 2 * radius];
+                for (int x = 0; x < width; ++x)
+                    out[x * 4 + c] = divide((int)floor(in[x] + 0.5));
+            }
+        }
+
+        // move the partial rows up to start the next row of tiles
+        for (int c = 0; c < c_channels; ++c)
+        {
+            double* strip = &acc[c * acc_size];
+            memmove(strip, strip + rows * acc_w, sizeof(double) * (size - 1) * acc_w);
+            fill(strip + (size - 1) * acc_w, strip + acc_size, 0.0);
+        }
+    }
+}// Fft_Convolve_Rows
@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.h                           Author:     Benjamin Reichert
+//
+//      Fixed-point convolution engine used by the TargaImage filters.  A
+//  kernel given as doubles is turned into integer taps over a common
+//  divisor (16, 81, 256, ...).  Separable kernels are run as a horizontal
+//  and a vertical 1-D pass, everything else goes through a 2-D integer
+//  path.  Both paths truncate the exact rational result, so there is none of
+//  the drift of summing doubles (254.9999 becoming 254).
+//
+//  Box blurs and wide Gaussians have their own engines whose cost does not
+//  grow with the kernel: running sums and a recursive (IIR) filter.  Large
+//  kernels of any shape can go through an FFT instead, which gives the same
+//  result as the spatial paths at a cost that grows with the log of the size.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CONVOLUTION_H_
+#define _CONVOLUTION_H_
+
+#include <vector>
+
+class ConvolutionKernel
+{
+    // methods
+    public:
+        ConvolutionKernel(int size, const double* weights);     // size x size weights, row major
+        ConvolutionKernel(const std::vector<int>& factor, int divisor); // factor x factor over divisor
+
+        bool Is_Separable() const { return separable; }
+        int  Taps_Per_Pixel() const { return separable ? 2 * size : size * size; }
+
+    private:
+        void Find_Divisor(const double* weights);
+        void Find_Factors();
+
+    // members
+    public:
+        int                 size;           // kernel is size x size, size is odd
+        int                 radius;         // size / 2
+        int                 divisor;        // every tap is an integer over this value
+        bool                separable;      // taps[i][j] == column[i] * row[j]
+        std::vector<int>    taps;           // size * size integer taps, row major
+        std::vector<int>    row;            // horizontal factor of a separable kernel
+        std::vector<int>    column;         // vertical factor of a separable kernel
+};
+
+
+// Reflect an index about the image border the way the filters always have:
+// -1 maps to 1 and n maps to n - 2.
+int Reflect_Index(int i, int n);
+
+// Convolve the RGB channels of src into dst for output rows [y_begin, y_end).
+// Both buffers are width x height RGBA, src holds straight (not premultiplied)
+// color, and the alpha channel of dst is left untouched.  src and dst must not
+// overlap.
+void Convolve_Rows(const ConvolutionKernel& kernel, const unsigned char* src, unsigned char* dst,
+                   int width, int height, int y_begin, int y_end);
+
+// Largest radius Box_Blur_Rows takes; the window sums must fit an int.
+const int c_maxBoxRadius = 1023;
+
+// Same as Convolve_Rows with a (2 * radius + 1) square box kernel, but with
+// running sums so the cost per pixel is the same for any radius.
+void Box_Blur_Rows(int radius, const unsigned char* src, unsigned char* dst,
+                   int width, int height, int y_begin, int y_end);
+
+// Reflected samples the recursive Gaussian runs through before the first
+// and after the last pixel of a line of n, so its start up has died away.
+// It stops at one period of the reflected line plus one, past which the
+// start is solved for instead.
+int Recursive_Gaussian_Margin(double sigma, int n);
+
+// Rows the recursive Gaussian filters in one go on an image height rows
+// tall.  Bands that start and end on multiples of it from the top of the
+// image do no work twice.
+int Recursive_Gaussian_Chunk(double sigma, int height);
+
+// Gaussian blur of standard deviation sigma with Deriche's fourth order
+// recursive filter, same buffers and borders as Convolve_Rows.  The result
+// is rounded rather than truncated since it is only an approximation.  Cost
+// per pixel does not depend on sigma; below a sigma of 1 the fit is poor.
+void Recursive_Gaussian_Rows(double sigma, const unsigned char* src, unsigned char* dst,
+                             int width, int height, int y_begin, int y_end);
+
+// Same result as Convolve_Rows, but multiplying tile by tile in the
+// frequency domain (overlap-add), so the cost per pixel grows with the log of
+// the kernel size rather than its area.  The sums are exact as long as they
+// fit an int, the same limit the spatial path has.
+void Fft_Convolve_Rows(const ConvolutionKernel& kernel, const unsigned char* src, unsigned char* dst,
+                       int width, int height, int y_begin, int y_end);
+
+// Output rows Fft_Convolve_Rows covers with one row of tiles; bands shorter
+// than this pay for transforms mostly full of padding.
+int Fft_Tile_Rows(const ConvolutionKernel& kernel);
+
+#endif
@@ -0,0 +1,339 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ErrorDiffusion.h                        Author:     Benjamin Reichert
+//
+//      Error diffusion dithering for any diffusion matrix and set of output
+//  levels.  Both are template parameters, so the weights and levels are
+//  constants the compiler folds into the pixel loop: zero weights vanish,
+//  the loops over the matrix unroll, and the errors for the rest of the
+//  current row stay in registers.
+//
+//  Errors are whole levels of a channel.  They are spread as multiples of
+//  the matrix weights into one integer array per row the matrix reaches
+//  below the current one, and divided by the matrix divisor, rounding, when
+//  a pixel takes them in.  The arrays are reused as the rows roll by.
+//
+//  A plain left to right scan runs on the thread pool as a wavefront.
+//  Rows are handed out in order and each follows the row above far enough
+//  behind that every error it needs has arrived, and that it only adds to
+//  an error after the rows above have finished adding to it, so the result
+//  is the same as one serial pass for any number of threads.  A serpentine
+//  scan alternates direction each row; a row then needs the whole row
+//  above, so the rows run one after another.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ERROR_DIFFUSION_H_
+#define _ERROR_DIFFUSION_H_
+
+#include "Globals.h"
+#include "ThreadPool.h"
+#include "PixelKernels.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+
+const int c_diffusionChunk = 64;        // pixels of a row finished before the row below is told
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Diffusion matrices.  c_weights[r][c_reach + dx] is the share of a
+//  pixel's error given to the pixel dx to its right on the r'th row below
+//  it, out of c_divisor.  Row 0 is the pixel's own row, where only pixels
+//  still to come get a share.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct FloydSteinberg
+{
+    static const int            c_rows = 2;
+    static const int            c_reach = 1;
+    static const int            c_divisor = 16;
+    static constexpr int        c_weights[c_rows][2 * c_reach + 1] =
+    {
+        { 0, 0, 7 },
+        { 3, 5, 1 }
+    };
+};// FloydSteinberg
+
+struct JarvisJudiceNinke
+{
+    static const int            c_rows = 3;
+    static const int            c_reach = 2;
+    static const int            c_divisor = 48;
+    static constexpr int        c_weights[c_rows][2 * c_reach + 1] =
+    {
+        { 0, 0, 0, 7, 5 },
+        { 3, 5, 7, 5, 3 },
+        { 1, 3, 5, 3, 1 }
+    };
+};// JarvisJudiceNinke
+
+struct Stucki
+{
+    static const int            c_rows = 3;
+    static const int            c_reach = 2;
+    static const int            c_divisor = 42;
+    static constexpr int        c_weights[c_rows][2 * c_reach + 1] =
+    {
+        { 0, 0, 0, 8, 4 },
+        { 2, 4, 8, 4, 2 },
+        { 1, 2, 4, 2, 1 }
+    };
+};// Stucki
+
+struct Burkes
+{
+    static const int            c_rows = 2;
+    static const int            c_reach = 2;
+    static const int            c_divisor = 32;
+    static constexpr int        c_weights[c_rows][2 * c_reach + 1] =
+    {
+        { 0, 0, 0, 8, 4 },
+        { 2, 4, 8, 4, 2 }
+    };
+};// Burkes
+
+// Atkinson passes on only 6/8 of the error, which keeps highlights and
+// shadows clean at the cost of some tone.
+struct Atkinson
+{
+    static const int            c_rows = 3;
+    static const int            c_reach = 2;
+    static const int            c_divisor = 8;
+    static constexpr int        c_weights[c_rows][2 * c_reach + 1] =
+    {
+        { 0, 0, 0, 1, 1 },
+        { 0, 1, 1, 1, 0 },
+        { 0, 0, 1, 0, 0 }
+    };
+};// Atkinson
+
+
+// n / divisor rounded to the nearest integer, halves up, for either sign.
+template <int divisor>
+inline int Divide_Rounded(int n)
+{
+    n += divisor / 2;
+    return (n >= 0 ? n : n - (divisor - 1)) / divisor;
+}// Divide_Rounded
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Output levels.  Read gives the straight channel values of a
+//  premultiplied pixel, Quantize the level a channel value becomes, and
+//  Write stores the levels of a pixel, leaving alpha as it is.  Quantize
+//  may clamp the value, and the error is taken from what it leaves.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// Black and white from a gray image, the gray level being the straight red.
+struct GrayLevels
+{
+    static const int    c_channels = 1;
+    typedef int         Error;
+
+    static inline void Read(const unsigned char* rgba, int* value)
+    {
+        if (rgba[3] == 255)
+            value[0] = rgba[0];
+        else
+        {
+            unsigned char rgb[3];
+            Unpremultiply_Pixel(rgba, rgb);
+            value[0] = rgb[0];
+        }
+    }// Read
+
+    static inline int Quantize(int, int& value)
+    {
+        return value >= 128 ? 255 : 0;
+    }// Quantize
+
+    static inline void Write(unsigned char* rgba, const int* level)
+    {
+        rgba[0] = rgba[1] = rgba[2] = (unsigned char)level[0];
+    }// Write
+};// GrayLevels
+
+
+// The levels of Quant_Uniform: 8 of red and green, 32 apart, and 4 of blue,
+// 64 apart.  Translucent pixels are straightened in integers.  Values are
+// clamped to 0 to 255 before they are rounded to the nearest level, so an
+// error is never more than 63 and the sums of them fit a short.
+struct UniformLevels
+{
+    static const int    c_channels = 3;
+    typedef short       Error;
+
+    static inline void Read(const unsigned char* rgba, int* value)
+    {
+        int alpha = rgba[3];
+
+        for (int c = 0; c < 3; ++c)
+        {
+            if (alpha == 255)
+                value[c] = rgba[c];
+            else
+                value[c] = alpha ? Min(rgba[c] * 255 / alpha, 255) : 0;
+        }
+    }// Read
+
+    static inline int Quantize(int channel, int& value)
+    {
+        int spacing = channel == 2 ? 64 : 32;
+
+        value = Max(0, Min(value, 255));
+        return Min((value + spacing / 2) & ~(spacing - 1), 256 - spacing);
+    }// Quantize
+
+    static inline void Write(unsigned char* rgba, const int* level)
+    {
+        rgba[0] = (unsigned char)level[0];
+        rgba[1] = (unsigned char)level[1];
+        rgba[2] = (unsigned char)level[2];
+    }// Write
+};// UniformLevels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither count pixels of a row from x on, going step pixels at a time.
+//  ahead holds the errors passed along the row for the next c_reach pixels
+//  of each channel.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class M, class Q, int step>
+inline void Diffuse_Span(unsigned char* row, const typename Q::Error* error_in, typename Q::Error* const* error_out,
+                         int (*ahead)[M::c_reach + 1], int x, int count)
+{
+    const int R = M::c_reach;
+    const int C = Q::c_channels;
+
+    // kept in locals so they stay in registers through the stores below
+    int next[C][R + 1];
+    for (int c = 0; c < C; ++c)
+        for (int dx = 1; dx <= R; ++dx)
+            next[c][dx] = ahead[c][dx];
+
+    for (int i = 0; i < count; ++i, x += step)
+    {
+        int value[C];
+        int level[C];
+
+        Q::Read(row + x * 4, value);
+
+        for (int c = 0; c < C; ++c)
+        {
+            value[c] += Divide_Rounded<M::c_divisor>(error_in[x * C + c] + next[c][1]);
+            level[c] = Q::Quantize(c, value[c]);
+            int error = value[c] - level[c];
+
+            for (int dx = 1; dx < R; ++dx)
+                next[c][dx] = next[c][dx + 1] + M::c_weights[0][R + dx] * error;
+            next[c][R] = M::c_weights[0][2 * R] * error;
+
+            for (int r = 1; r < M::c_rows; ++r)
+            {
+                for (int dx = -R; dx <= R; ++dx)
+                {
+                    int                     weight = M::c_weights[r][R + dx];
+                    typename Q::Error*      target = &error_out[r][(x + step * dx) * C + c];
+
+                    if (r == M::c_rows - 1 && dx == R)
+                        *target = (typename Q::Error)(weight * error);
+                    else if (weight)
+                        *target = (typename Q::Error)(*target + weight * error);
+                }
+            }
+        }
+
+        Q::Write(row + x * 4, level);
+    }
+
+    for (int c = 0; c < C; ++c)
+        for (int dx = 1; dx <= R; ++dx)
+            ahead[c][dx] = next[c][dx];
+}// Diffuse_Span
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither premultiplied rgba pixels to the levels Q with the matrix M,
+//  in one pass that reads each pixel, takes in its error, quantizes it and
+//  writes it back.  Alpha is left as it is.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class M, class Q>
+void Diffuse_Errors(unsigned char* data, int width, int height, bool serpentine)
+{
+    typedef typename Q::Error Error;
+
+    const int R = M::c_reach;
+    const int C = Q::c_channels;
+
+    // A row adds to the errors of a pixel up to (c_rows - 1) * c_reach
+    // pixels after the row above, which adds to them up to c_reach pixels
+    // after taking its own in, so that is how far behind it has to stay.
+    const int lag = serpentine ? width : (M::c_rows - 1) * R;
+
+    std::vector<Error>      errors[M::c_rows];      // by row y % c_rows, R pixels of margin each side
+    std::vector< std::atomic<int> > done(height);   // pixels of each row finished
+    std::atomic<int>        next_row(0);
+
+    for (int r = 0; r < M::c_rows; ++r)
+        errors[r].assign((width + 2 * R) * C, 0);
+    for (int y = 0; y < height; ++y)
+        done[y].store(0);
+
+    Parallel_For_Rows(ThreadPool::Instance().Thread_Count(), [&](int, int)
+    {
+        for (int y = next_row++; y < height; y = next_row++)
+        {
+            unsigned char*  row = data + y * width * 4;
+            bool            reverse = serpentine && (y & 1);
+            int             step = reverse ? -1 : 1;
+            const Error*    error_in = &errors[y % M::c_rows][R * C];
+            Error*          error_out[M::c_rows];
+            int             ahead[C][R + 1] = {};       // error for the next R pixels of this row
+
+            for (int r = 1; r < M::c_rows; ++r)
+                error_out[r] = &errors[(y + r) % M::c_rows][R * C];
+
+            for (int i_begin = 0; i_begin < width; i_begin += c_diffusionChunk)
+            {
+                int i_end = Min(i_begin + c_diffusionChunk, width);
+
+                if (y > 0)
+                {
+                    int needed = Min(i_end + lag, width);
+                    while (done[y - 1].load(std::memory_order_acquire) < needed)
+                        std::this_thread::yield();
+                }
+
+                // The last row down is the first to touch its array since
+                // the array was last read; it sets each error the first time
+                // it reaches it, except for the few it reaches first at the
+                // start of the row, which are cleared here.
+                if (i_begin == 0)
+                {
+                    int start = reverse ? width - 1 : 0;
+                    for (int dx = -R; dx < R; ++dx)
+                        for (int c = 0; c < C; ++c)
+                            error_out[M::c_rows - 1][(start + step * dx) * C + c] = 0;
+                }
+
+                if (reverse)
+                    Diffuse_Span<M, Q, -1>(row, error_in, error_out, ahead, width - 1 - i_begin, i_end - i_begin);
+                else
+                    Diffuse_Span<M, Q, 1>(row, error_in, error_out, ahead, i_begin, i_end - i_begin);
+
+                done[y].store(i_end, std::memory_order_release);
+            }
+        }
+    }, 1);
+}// Diffuse_Errors
+
+
+#endif
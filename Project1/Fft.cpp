@@ -0,0 +1,192 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fft.cpp                                 Author:     Benjamin Reichert
+//
+//      Implementation of the mixed radix FFT.  See Fft.h for an overview.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Fft.h"
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+typedef complex<double> Complex;
+
+// constants
+const double    c_pi            = 3.14159265358979323846;
+const double    c_sin60         = 0.86602540378443864676;   // sqrt(3) / 2
+const int       c_radices[]     = { 4, 2, 3, 5 };           // radices tried, in the order their stages run
+
+
+// Complex product written out; the library operator checks for infinities
+// and is several times slower.
+static inline Complex Mul(const Complex& a, const Complex& b)
+{
+    return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+}// Mul
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Factor the length and build the table of roots.
+//
+///////////////////////////////////////////////////////////////////////////////
+Fft::Fft(int length)
+    : n(length), roots(length)
+{
+    for (int k = 0; k < n; ++k)
+        roots[k] = Complex(cos(2 * c_pi * k / n), -sin(2 * c_pi * k / n));
+
+    int rest = n;
+    for (int i = 0; i < (int)(sizeof(c_radices) / sizeof(c_radices[0])); ++i)
+        while (rest % c_radices[i] == 0)
+        {
+            factors.push_back(c_radices[i]);
+            rest /= c_radices[i];
+        }
+}// Fft
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Smallest length the transform takes that is at least n.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Fft::Fast_Size(int n)
+{
+    for (int size = n > 1 ? n : 1; ; ++size)
+    {
+        int rest = size;
+        while (rest % 2 == 0)
+            rest /= 2;
+        while (rest % 3 == 0)
+            rest /= 3;
+        while (rest % 5 == 0)
+            rest /= 5;
+        if (rest == 1)
+            return size;
+    }
+}// Fast_Size
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Forward transform.  Each stage splits the sequences s already done
+//  into radix interleaved pieces and writes the other buffer, so the result
+//  ends up in work after an odd number of stages and is copied back.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Fft::Forward(Complex* data, Complex* work, int batch) const
+{
+    Complex*    in = data;
+    Complex*    out = work;
+    int         s = 1;
+
+    for (size_t i = 0; i < factors.size(); ++i)
+    {
+        int radix = factors[i];
+        Stage(radix, n / (s * radix), s, s * batch, in, out);
+
+        Complex* t = in;
+        in = out;
+        out = t;
+        s *= radix;
+    }
+
+    if (in != data)
+        memcpy(data, in, sizeof(Complex) * n * batch);
+}// Forward
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      One Stockham stage.  The current sub-transforms have length
+//  m * radix, and their elements are stride apart.  Output j of butterfly p
+//  is scaled by the root for j * p at this length.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Fft::Stage(int radix, int m, int s, int stride, const Complex* in, Complex* out) const
+{
+    const int   span = m * stride;      // distance between butterfly inputs
+
+    for (int p = 0; p < m; ++p)
+    {
+        const Complex*  x = in + p * stride;
+        Complex*        y = out + radix * p * stride;
+        const Complex   w1 = roots[p * s];
+
+        switch (radix)
+        {
+            case 2:
+            {
+                for (int q = 0; q < stride; ++q)
+                {
+                    Complex a0 = x[q], a1 = x[q + span];
+                    y[q]          = a0 + a1;
+                    y[q + stride] = Mul(a0 - a1, w1);
+                }
+                break;
+            }// 2
+
+            case 4:
+            {
+                const Complex w2 = roots[2 * p * s];
+                const Complex w3 = roots[3 * p * s];
+                for (int q = 0; q < stride; ++q)
+                {
+                    Complex a0 = x[q], a1 = x[q + span], a2 = x[q + 2 * span], a3 = x[q + 3 * span];
+                    Complex s02 = a0 + a2, d02 = a0 - a2;
+                    Complex s13 = a1 + a3, d13 = a1 - a3;
+                    Complex jd13(d13.imag(), -d13.real());          // -i * d13
+
+                    y[q]              = s02 + s13;
+                    y[q + stride]     = Mul(d02 + jd13, w1);
+                    y[q + 2 * stride] = Mul(s02 - s13, w2);
+                    y[q + 3 * stride] = Mul(d02 - jd13, w3);
+                }
+                break;
+            }// 4
+
+            case 3:
+            {
+                const Complex w2 = roots[2 * p * s];
+                for (int q = 0; q < stride; ++q)
+                {
+                    Complex a0 = x[q], a1 = x[q + span], a2 = x[q + 2 * span];
+                    Complex t = a1 + a2, d = a1 - a2;
+                    Complex c = a0 - 0.5 * t;
+                    Complex jd(c_sin60 * d.imag(), -c_sin60 * d.real());  // -i sin60 * d
+
+                    y[q]              = a0 + t;
+                    y[q + stride]     = Mul(c + jd, w1);
+                    y[q + 2 * stride] = Mul(c - jd, w2);
+                }
+                break;
+            }// 3
+
+            default:
+            {
+                // small radix, plain DFT of the butterfly inputs
+                const int   step = n / radix;
+                Complex     a[5];
+                for (int q = 0; q < stride; ++q)
+                {
+                    for (int k = 0; k < radix; ++k)
+                        a[k] = x[q + k * span];
+
+                    for (int j = 0; j < radix; ++j)
+                    {
+                        Complex b = a[0];
+                        for (int k = 1; k < radix; ++k)
+                            b += Mul(a[k], roots[(j * k % radix) * step]);
+                        y[q + j * stride] = j ? Mul(b, roots[j * p * s]) : b;
+                    }
+                }
+                break;
+            }// default
+        }// switch
+    }
+}// Stage
@@ -0,0 +1,47 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fft.h                                   Author:     Benjamin Reichert
+//
+//      Complex fast Fourier transform for the convolution engine.  Lengths
+//  are products of 2, 3 and 5 and each pass is a Stockham autosort stage,
+//  so there is no bit reversal and the output comes out in natural order.
+//
+//  A transform can run on a batch of interleaved sequences at once: element
+//  k of sequence b lives at data[k * batch + b].  Handing it a row major
+//  image with batch = width transforms every column, and each inner loop
+//  runs along a row.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _FFT_H_
+#define _FFT_H_
+
+#include <complex>
+#include <vector>
+
+class Fft
+{
+    // methods
+    public:
+        Fft(int n);                                 // n must be a product of 2, 3 and 5
+
+        int Size() const { return n; }
+
+        // forward transform of batch sequences in place, work holds n * batch entries
+        void Forward(std::complex<double>* data, std::complex<double>* work, int batch = 1) const;
+
+        static int Fast_Size(int n);                // smallest product of 2, 3 and 5 at least n
+
+    private:
+        void Stage(int radix, int m, int s, int stride,
+                   const std::complex<double>* in, std::complex<double>* out) const;
+
+    // members
+    private:
+        int                                 n;
+        std::vector<int>                    factors;    // radices in the order they run
+        std::vector<std::complex<double> >  roots;      // exp(-2 pi i k / n)
+};
+
+
+#endif
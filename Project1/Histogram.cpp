@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Histogram.cpp                           Author:     Benjamin Reichert
+//
+//      Implementation of the parallel histogram.  See Histogram.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Histogram.h"
+#include "ThreadPool.h"
+#include <mutex>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  All bins start empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+Histogram::Histogram(int bins)
+    : counts(bins, 0)
+{}// Histogram
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count the rows on the pool.  Every band fills private bins and adds
+//  them in under the lock when it finishes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Histogram::Build(int rows, const HistogramBandFunction& band, int min_rows)
+{
+    mutex merge;
+
+    Parallel_For_Rows(rows, [&](int y_begin, int y_end)
+    {
+        vector<unsigned int> local(counts.size(), 0);
+        band(y_begin, y_end, &local[0]);
+
+        lock_guard<mutex> lock(merge);
+        for (size_t i = 0; i < counts.size(); ++i)
+            counts[i] += local[i];
+    }, min_rows);
+}// Build
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of samples counted.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned int Histogram::Total() const
+{
+    unsigned int total = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+        total += counts[i];
+    return total;
+}// Total
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Sum of the samples, taking each to be its bin index.  Exact while it
+//  stays below 2^53.
+//
+///////////////////////////////////////////////////////////////////////////////
+double Histogram::Sum() const
+{
+    double sum = 0;
+    for (size_t i = 0; i < counts.size(); ++i)
+        sum += (double)i * counts[i];
+    return sum;
+}// Sum
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The bin a sort of the samples would have at position rank: the first
+//  whose prefix sum passes rank.  Ranks past the end give the last bin
+//  holding a sample, or 0 if the histogram is empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Histogram::Bin_Of_Rank(unsigned int rank) const
+{
+    unsigned int    below = 0;
+    int             last = 0;
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        if (!counts[i])
+            continue;
+
+        below += counts[i];
+        last = (int)i;
+        if (below > rank)
+            break;
+    }
+
+    return last;
+}// Bin_Of_Rank
@@ -0,0 +1,47 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Histogram.h                             Author:     Benjamin Reichert
+//
+//      Counts of image samples over a fixed number of bins, for operations
+//  that need statistics of the whole image.  Build walks the rows on the
+//  thread pool; each band counts into its own private bins, which are
+//  merged into the histogram once the band is done, so the counting itself
+//  never shares a cache line.
+//
+//  Ranks and percentiles come from a prefix sum over the bins, so finding
+//  the median of an image costs one pass over it instead of a sort.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <functional>
+#include <vector>
+
+// count the samples of rows [y_begin, y_end) into bins
+typedef std::function<void (int, int, unsigned int*)> HistogramBandFunction;
+
+class Histogram
+{
+    // methods
+    public:
+        Histogram(int bins = 256);
+
+        // count the samples of rows [0, rows), adding to what is already there
+        void Build(int rows, const HistogramBandFunction& band, int min_rows = 8);
+
+        int             Bins() const { return (int)counts.size(); }
+        unsigned int    Count(int bin) const { return counts[bin]; }
+        unsigned int    Total() const;
+        double          Sum() const;                    // bin index weighted by its count
+
+        int             Bin_Of_Rank(unsigned int rank) const;   // bin of the rank'th smallest sample, from 0
+
+    // members
+    private:
+        std::vector<unsigned int>   counts;
+};
+
+
+#endif
@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageMetrics.cpp                        Author:     Benjamin Reichert
+//
+//      Implementation of the image quality metrics.  See ImageMetrics.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ImageMetrics.h"
+#include "PixelKernels.h"
+#include "ThreadPool.h"
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+const double c_ssimC1 = (0.01 * 255) * (0.01 * 255);   // stabilizers of the SSIM ratios
+const double c_ssimC2 = (0.03 * 255) * (0.03 * 255);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSIM of one block from its luma moments: the sums over its n pixels
+//  of x, y, x*x, y*y and x*y.
+//
+///////////////////////////////////////////////////////////////////////////////
+static double Block_Ssim(const double* sums, int n)
+{
+    double mean_x = sums[0] / n;
+    double mean_y = sums[1] / n;
+    double var_x = sums[2] / n - mean_x * mean_x;
+    double var_y = sums[3] / n - mean_y * mean_y;
+    double cov = sums[4] / n - mean_x * mean_y;
+
+    return ((2 * mean_x * mean_y + c_ssimC1) * (2 * cov + c_ssimC2)) /
+           ((mean_x * mean_x + mean_y * mean_y + c_ssimC1) * (var_x + var_y + c_ssimC2));
+}// Block_Ssim
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Measure the images a block row at a time on the pool.  Each band
+//  keeps private totals and adds them in under the lock when it finishes.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageMetrics Measure_Images(const unsigned char* a, const unsigned char* b, int width, int height)
+{
+    CompareSums totals = { 0, 0, 0 };
+    double      ssim_total = 0;
+    mutex       merge;
+
+    const PixelKernels& kernels = Pixel_Kernels();
+    int block_rows = width > 0 ? (height + c_ssimBlock - 1) / c_ssimBlock : 0;
+
+    Parallel_For_Rows(block_rows, [&](int r_begin, int r_end)
+    {
+        vector<unsigned char>   row_a(width * 4);
+        vector<unsigned char>   row_b(width * 4);
+        vector<unsigned int>    moments(width * 5);
+        CompareSums             sums = { 0, 0, 0 };
+        double                  ssim = 0;
+
+        for (int r = r_begin; r < r_end; ++r)
+        {
+            int y_begin = r * c_ssimBlock;
+            int y_end = Min(y_begin + c_ssimBlock, height);
+
+            fill(moments.begin(), moments.end(), 0);
+            for (int y = y_begin; y < y_end; ++y)
+            {
+                kernels.Straighten_Row(a + y * width * 4, &row_a[0], width);
+                kernels.Straighten_Row(b + y * width * 4, &row_b[0], width);
+                kernels.Compare_Row(&row_a[0], &row_b[0], width, sums, &moments[0]);
+            }
+
+            for (int x_begin = 0; x_begin < width; x_begin += c_ssimBlock)
+            {
+                int     x_end = Min(x_begin + c_ssimBlock, width);
+                double  block[5] = { 0, 0, 0, 0, 0 };
+
+                for (int k = 0; k < 5; ++k)
+                    for (int x = x_begin; x < x_end; ++x)
+                        block[k] += moments[k * width + x];
+
+                int n = (x_end - x_begin) * (y_end - y_begin);
+                ssim += n * Block_Ssim(block, n);
+            }
+        }
+
+        lock_guard<mutex> lock(merge);
+        totals.squared_error += sums.squared_error;
+        totals.max_error = Max(totals.max_error, sums.max_error);
+        totals.mismatches += sums.mismatches;
+        ssim_total += ssim;
+    }, 1);
+
+    ImageMetrics    metrics;
+    double          pixels = (double)width * height;
+
+    metrics.mse = pixels ? totals.squared_error / (3 * pixels) : 0;
+    metrics.psnr = metrics.mse ? 10 * log10(255.0 * 255.0 / metrics.mse) : numeric_limits<double>::infinity();
+    metrics.max_error = totals.max_error;
+    metrics.mismatches = totals.mismatches;
+    metrics.ssim = pixels ? ssim_total / pixels : 1;
+
+    return metrics;
+}// Measure_Images
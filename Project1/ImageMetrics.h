@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageMetrics.h                          Author:     Benjamin Reichert
+//
+//      Image quality metrics of one image against another, for checking the
+//  output of an operation against a reference.  Everything is measured in
+//  one pass over the two images: each band of rows is straightened and
+//  handed to the Compare_Row kernel, which totals the errors and the luma
+//  moments SSIM needs as it goes, so nothing is written back and no
+//  difference image is made.
+//
+//  SSIM is taken over 8x8 blocks that tile the image, with the usual
+//  constants for 8 bit samples, and averaged with each block weighted by
+//  its pixels, so the smaller blocks at the edges count for less.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_METRICS_H_
+#define _IMAGE_METRICS_H_
+
+const int c_ssimBlock = 8;              // side of the SSIM blocks, in pixels
+
+struct ImageMetrics
+{
+    double      mse;            // mean squared error of r, g and b
+    double      psnr;           // peak signal to noise ratio in dB, infinite for equal colors
+    int         max_error;      // largest difference of any channel, alpha included
+    long long   mismatches;     // pixels that differ in any channel
+    double      ssim;           // mean structural similarity of the luma
+};// ImageMetrics
+
+
+// compare two premultiplied images of the same size by their straight color
+ImageMetrics Measure_Images(const unsigned char* a, const unsigned char* b, int width, int height);
+
+
+#endif
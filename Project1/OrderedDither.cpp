@@ -0,0 +1,145 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      OrderedDither.cpp                       Author:     Benjamin Reichert
+//
+//      Implementation of the ordered dithering engine.  See OrderedDither.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "OrderedDither.h"
+#include "PixelKernels.h"
+#include "ThreadPool.h"
+#include <string.h>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Copies the thresholds.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThresholdMatrix::ThresholdMatrix(int w, int h, const unsigned char* t)
+    : width(w), height(h), thresholds(t, t + w * h)
+{
+}// ThresholdMatrix
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The Bayer matrix of the given size.  Each doubling puts four copies
+//  of the smaller matrix, times four, side by side and adds 0, 2, 3 and 1
+//  to them, so that every run of levels is spread as evenly as possible.
+//  Level b of n*n covers the middle of its share of the gray scale, and a
+//  pixel is white when gray/255 > (b + 1/2)/(n*n).  That never holds for
+//  black and always does for white.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThresholdMatrix ThresholdMatrix::Bayer(int size)
+{
+    static const int c_offsets[2][2] = { { 0, 2 }, { 3, 1 } };
+
+    vector<int> levels(1, 0);
+    int         n = 1;
+
+    for (; n < size && n < c_maxBayerSize; n *= 2)
+    {
+        vector<int> doubled(4 * n * n);
+
+        for (int y = 0; y < 2 * n; ++y)
+            for (int x = 0; x < 2 * n; ++x)
+                doubled[y * 2 * n + x] = 4 * levels[(y % n) * n + x % n] + c_offsets[y / n][x / n];
+        levels.swap(doubled);
+    }
+
+    vector<unsigned char> t(n * n);
+    for (int i = 0; i < n * n; ++i)
+        t[i] = (unsigned char)((2 * levels[i] + 1) * 255 / (2 * n * n));
+
+    return ThresholdMatrix(n, n, &t[0]);
+}// Bayer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The clustered dot matrix.  A pixel is white if I[x][y] >= mask[x%4][y%4],
+//  with I scaled to [0, 1).  The entries are all sixteenths, so that is
+//  exactly pixel > mask*256 - 1.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThresholdMatrix ThresholdMatrix::Cluster()
+{
+    static const float c_mask[4][4] = { { .75,    .375,   .625,   .25   },
+                                        { .0625,  1,      .875,   .4375 },
+                                        { .5,     .8125,  .9375,  .1250 },
+                                        { .1875,  .5625,  .3125,  .6875 } };
+
+    unsigned char t[16];
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+            t[i * 4 + j] = (unsigned char)(c_mask[i][j] * 256 - 1);
+
+    return ThresholdMatrix(4, 4, t);
+}// Cluster
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      A matrix from an image, the straight red of each pixel its entry.
+//  255 is lowered to 254 so that white stays white everywhere.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThresholdMatrix ThresholdMatrix::From_Pixels(const unsigned char* rgba, int w, int h)
+{
+    vector<unsigned char> t(w * h);
+
+    for (int i = 0; i < w * h; ++i, rgba += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(rgba, rgb);
+        t[i] = Min(rgb[0], (unsigned char)254);
+    }
+
+    return ThresholdMatrix(w, h, &t[0]);
+}// From_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither an image.  The matrix rows the image reaches are tiled out to
+//  the image width first; after that each image row is one kernel call
+//  against its tiled row.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThresholdMatrix::Dither(unsigned char* rgba, int image_width, int image_height) const
+{
+    int rows = Min(height, image_height);
+    if (rows <= 0 || image_width <= 0)
+        return;
+
+    vector<unsigned char> tiled(rows * image_width);
+
+    for (int y = 0; y < rows; ++y)
+    {
+        unsigned char*          out = &tiled[y * image_width];
+        const unsigned char*    in = &thresholds[y * width];
+
+        // copy the row once, then keep doubling what is there
+        int filled = Min(width, image_width);
+        memcpy(out, in, filled);
+        while (filled < image_width)
+        {
+            int count = Min(filled, image_width - filled);
+            memcpy(out + filled, out, count);
+            filled += count;
+        }
+    }
+
+    const PixelKernels& kernels = Pixel_Kernels();
+    Parallel_For_Rows(image_height, [&](int y_begin, int y_end)
+    {
+        for (int y = y_begin; y < y_end; ++y)
+            kernels.Ordered_Row(rgba + y * image_width * 4, image_width, &tiled[(y % height) * image_width]);
+    });
+}// Dither
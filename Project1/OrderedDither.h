@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      OrderedDither.h                         Author:     Benjamin Reichert
+//
+//      Ordered dithering with any threshold matrix.  A gray pixel becomes
+//  white when its value is greater than the matrix entry its position
+//  falls on, the matrix repeating across the image.  Entries are byte
+//  thresholds, scaled once when the matrix is made.
+//
+//  Before dithering, each matrix row is repeated out to the width of the
+//  image, so a pixel's threshold sits at the same offset in its tiled row
+//  as the pixel does in its image row, and the kernels compare a whole
+//  vector of pixels against one load of thresholds.  No pixel depends on
+//  another, so the rows are shared out over the thread pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ORDERED_DITHER_H_
+#define _ORDERED_DITHER_H_
+
+#include <vector>
+
+const int c_maxBayerSize = 16;          // 256 entries, one per byte threshold
+
+class ThresholdMatrix
+{
+    // methods
+    public:
+        // thresholds row by row, width entries to a row
+        ThresholdMatrix(int width, int height, const unsigned char* thresholds);
+
+        // the Bayer matrix of a power of two size from 2 to c_maxBayerSize
+        static ThresholdMatrix Bayer(int size);
+        // the 4x4 clustered dot matrix of Dither_Cluster
+        static ThresholdMatrix Cluster();
+        // the straight red of premultiplied pixels, e.g. a blue noise tile
+        static ThresholdMatrix From_Pixels(const unsigned char* rgba, int width, int height);
+
+        int             Width() const   { return width; }
+        int             Height() const  { return height; }
+        unsigned char   At(int x, int y) const { return thresholds[y * width + x]; }
+
+        // dither gray premultiplied pixels to black and white; alpha becomes opaque
+        void Dither(unsigned char* rgba, int image_width, int image_height) const;
+
+    // members
+    private:
+        int                         width;
+        int                         height;
+        std::vector<unsigned char>  thresholds;
+};
+
+
+#endif
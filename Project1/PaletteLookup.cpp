@@ -0,0 +1,206 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PaletteLookup.cpp                       Author:     Benjamin Reichert
+//
+//      Implementation of the nearest palette color search.  See
+//  PaletteLookup.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "PaletteLookup.h"
+#include "ThreadPool.h"
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Builds the tree over the palette and, in cell mode, the
+//  tables of nearest colors by cell, a band of red shades at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+PaletteLookup::PaletteLookup(const vector<unsigned char>& colors, EPaletteSearch mode)
+    : palette(colors.begin(), colors.begin() + Min((int)colors.size() / 3, c_maxPaletteColors) * 3),
+      search(mode), root(-1)
+{
+    vector<int> indices(Colors());
+    for (int i = 0; i < Colors(); i++)
+        indices[i] = i;
+
+    tree.reserve(Colors());
+    if (Colors())
+        root = Build_Tree(&indices[0], Colors());
+
+    if (search != PALETTE_CELLS || !Colors())
+        return;
+
+    nearest.resize(c_colorCells);
+    cell_colors.resize(c_colorCells);
+
+    Parallel_For_Rows(32, [&](int r_begin, int r_end)
+    {
+        int index = 0;
+
+        for (int cell = r_begin << 10; cell < r_end << 10; cell++)
+        {
+            unsigned char rgb[3];
+            Cell_Color(cell, rgb);
+
+            // neighbouring cells mostly share a color, so the last cell's
+            // is a close first guess that cuts most of the tree away
+            index = Nearest_Exact(rgb, index);
+            const unsigned char* color = Color(index);
+            nearest[cell] = (unsigned short)index;
+            cell_colors[cell] = color[0] | color[1] << 8 | color[2] << 16;
+        }
+    }, 1);
+}// PaletteLookup
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the subtree over count palette indices and return its root.
+//  Each node splits its colors at the median of the primary they spread
+//  furthest along.
+//
+///////////////////////////////////////////////////////////////////////////////
+int PaletteLookup::Build_Tree(int* indices, int count)
+{
+    int low[3] = { 255, 255, 255 };
+    int high[3] = { 0, 0, 0 };
+
+    for (int i = 0; i < count; i++)
+    {
+        const unsigned char* color = Color(indices[i]);
+        for (int c = 0; c < 3; c++)
+        {
+            low[c] = Min(low[c], (int)color[c]);
+            high[c] = Max(high[c], (int)color[c]);
+        }
+    }
+
+    int axis = 0;
+    for (int c = 1; c < 3; c++)
+    {
+        if (high[c] - low[c] > high[axis] - low[axis])
+            axis = c;
+    }
+
+    int median = count / 2;
+    nth_element(indices, indices + median, indices + count, [&](int a, int b)
+    {
+        return Color(a)[axis] != Color(b)[axis] ? Color(a)[axis] < Color(b)[axis] : a < b;
+    });
+
+    int node = (int)tree.size();
+    tree.push_back(KdNode());
+    tree[node].index = indices[median];
+    tree[node].axis = axis;
+
+    int below = median > 0 ? Build_Tree(indices, median) : -1;
+    int above = count - median > 1 ? Build_Tree(indices + median + 1, count - median - 1) : -1;
+    tree[node].below = below;
+    tree[node].above = above;
+
+    return node;
+}// Build_Tree
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look for a palette color nearer rgb than best in the subtree.  The
+//  side of a split rgb falls on is searched first, so best is as near as
+//  it can be before the far side is considered.  That side is skipped only
+//  when the split alone is farther than best, so equally near colors are
+//  all seen and the lowest index wins.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PaletteLookup::Search(int node, const unsigned char* rgb, int& best, int& best_distance) const
+{
+    while (node >= 0)
+    {
+        const KdNode&           n = tree[node];
+        const unsigned char*    color = Color(n.index);
+
+        int dr = rgb[0] - color[0];
+        int dg = rgb[1] - color[1];
+        int db = rgb[2] - color[2];
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance || (distance == best_distance && n.index < best))
+        {
+            best = n.index;
+            best_distance = distance;
+        }
+
+        int split = rgb[n.axis] - color[n.axis];
+        int nearer = split < 0 ? n.below : n.above;
+        int farther = split < 0 ? n.above : n.below;
+
+        if (nearer >= 0)
+            Search(nearer, rgb, best, best_distance);
+        if (split * split > best_distance)
+            break;
+        node = farther;
+    }
+}// Search
+
+
+int PaletteLookup::Nearest_Exact(const unsigned char* rgb, int guess) const
+{
+    const unsigned char* color = Color(guess);
+
+    int dr = rgb[0] - color[0];
+    int dg = rgb[1] - color[1];
+    int db = rgb[2] - color[2];
+    int best = guess;
+    int best_distance = dr * dr + dg * dg + db * db;
+
+    Search(root, rgb, best, best_distance);
+    return best;
+}// Nearest_Exact
+
+
+int PaletteLookup::Nearest(const unsigned char* rgb) const
+{
+    if (search == PALETTE_CELLS && !nearest.empty())
+        return nearest[Color_Cell(rgb)];
+    return Nearest_Exact(rgb);
+}// Nearest
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Map a row of pixels to the palette.  Cell mode hands the row to the
+//  palette kernel; exact mode searches once per run of one color.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PaletteLookup::Map_Row(unsigned char* rgba, int count) const
+{
+    if (!Colors())
+        return;
+
+    if (search == PALETTE_CELLS)
+    {
+        Pixel_Kernels().Palette_Row(rgba, count, &cell_colors[0]);
+        return;
+    }
+
+    unsigned char   last[3];
+    int             index = -1;
+
+    for (int i = 0; i < count; i++, rgba += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(rgba, rgb);
+
+        if (index < 0 || memcmp(rgb, last, 3))
+        {
+            index = Nearest_Exact(rgb, Max(index, 0));
+            memcpy(last, rgb, 3);
+        }
+        memcpy(rgba, Color(index), 3);
+    }
+}// Map_Row
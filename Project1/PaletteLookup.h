@@ -0,0 +1,87 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PaletteLookup.h                         Author:     Benjamin Reichert
+//
+//      Nearest palette color search, shared by the quantizers and dithers.
+//  The palette is put in a k-d tree, which finds the exact nearest color
+//  of any pixel in a few steps instead of one distance per palette color.
+//
+//  In cell mode the tree is only used up front, to find the nearest color
+//  of each cell of the 5-5-5 grid; after that a pixel's color is one table
+//  lookup by its cell, which the vector kernels do with gathers.  Exact
+//  mode searches the tree for every distinct color it is asked about.
+//  Both modes break ties toward the lower palette index.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PALETTE_LOOKUP_H_
+#define _PALETTE_LOOKUP_H_
+
+#include "PixelKernels.h"
+#include <vector>
+
+const int c_maxPaletteColors = 65536;           // indices have to fit an unsigned short
+
+enum EPaletteSearch     // how colors find their nearest palette color
+{
+    PALETTE_CELLS,      // the nearest color to the center of the color's 5-5-5 cell
+    PALETTE_EXACT       // the nearest color to the color itself
+};// EPaletteSearch
+
+
+// Color at the center of a 5-5-5 cell, each five bits widened to eight so
+// the shades reach 0 and 255.
+inline void Cell_Color(int cell, unsigned char* rgb)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        int shade = (cell >> (10 - 5 * i)) & 31;
+        rgb[i] = (unsigned char)(shade << 3 | shade >> 2);
+    }
+}// Cell_Color
+
+
+class PaletteLookup
+{
+    // methods
+    public:
+        // palette is packed rgb, at most c_maxPaletteColors colors
+        PaletteLookup(const std::vector<unsigned char>& palette, EPaletteSearch search = PALETTE_CELLS);
+
+        int                     Colors() const { return (int)palette.size() / 3; }
+        const unsigned char*    Color(int index) const { return &palette[index * 3]; }
+
+        int Nearest(const unsigned char* rgb) const;        // palette index for a straight color
+        // the same searching the tree, in either mode; a guess near the
+        // answer makes the search shorter
+        int Nearest_Exact(const unsigned char* rgb, int guess = 0) const;
+
+        // replace the straight color of premultiplied pixels by their palette
+        // colors; alpha unchanged
+        void Map_Row(unsigned char* rgba, int count) const;
+
+    private:
+        struct KdNode
+        {
+            int index;          // palette color splitting the node
+            int axis;           // primary it splits on
+            int below, above;   // children holding smaller and larger values, -1 for none
+        };
+
+        int     Build_Tree(int* indices, int count);
+        void    Search(int node, const unsigned char* rgb, int& best, int& best_distance) const;
+
+    // members
+    private:
+        std::vector<unsigned char>  palette;
+        EPaletteSearch              search;
+
+        std::vector<KdNode>         tree;
+        int                         root;
+
+        std::vector<unsigned short> nearest;            // palette index by cell, in cell mode
+        std::vector<unsigned int>   cell_colors;        // palette color by cell, packed 0x00bbggrr
+};
+
+
+#endif
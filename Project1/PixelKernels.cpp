@@ -0,0 +1,1349 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PixelKernels.cpp                        Author:     Benjamin Reichert
+//
+//      Scalar and vector versions of the pointwise row kernels, and picking
+//  between them from the CPU features.  See PixelKernels.h.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "PixelKernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define PIXEL_KERNELS_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+// gcc and clang need each function marked with the instruction set it uses,
+// vc lets any function use any intrinsic
+#if defined(PIXEL_KERNELS_X86) && defined(__GNUC__)
+    #define TARGET_SSE2     __attribute__((target("sse2")))
+    #define TARGET_AVX2     __attribute__((target("avx2")))
+    #define TARGET_AVX512   __attribute__((target("avx512f,avx512bw")))
+#else
+    #define TARGET_SSE2
+    #define TARGET_AVX2
+    #define TARGET_AVX512
+#endif
+
+
+// 255 / alpha as the float the conversion has always multiplied by, so the
+// table gives the same products as dividing did.  0 for alpha 0.
+static float s_alphaScale[256];
+
+static struct AlphaScaleInit
+{
+    AlphaScaleInit()
+    {
+        s_alphaScale[0] = 0;
+        for (int alpha = 1; alpha < 256; ++alpha)
+            s_alphaScale[alpha] = (float)255 / (float)alpha;
+    }
+} s_alphaScaleInit;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Straight color of a premultiplied pixel composited over black, the
+//  same conversion TargaImage has always used: floor(c * 255 / alpha) in
+//  float, clamped to 255.  The product is never negative, so truncating is
+//  the floor.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Unpremultiply_Pixel(const unsigned char* rgba, unsigned char* rgb)
+{
+    float alpha_scale = s_alphaScale[rgba[3]];
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        int val = (int)(rgba[i] * alpha_scale);
+        rgb[i] = (unsigned char)(val > 255 ? 255 : val);
+    }
+}// Unpremultiply_Pixel
+
+
+// Luma of a straight color.
+static inline unsigned char Luma(const unsigned char* rgb)
+{
+    return (unsigned char)((c_lumaRed * rgb[0] + c_lumaGreen * rgb[1] + c_lumaBlue * rgb[2]) >> c_lumaShift);
+}// Luma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar reference kernels.  These handle any alpha.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Gray_Row_Scalar(unsigned char* p, int count)
+{
+    for (int i = 0; i < count; ++i, p += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(p, rgb);
+        p[0] = p[1] = p[2] = Luma(rgb);
+    }
+}// Gray_Row_Scalar
+
+
+static void Quant_Uniform_Row_Scalar(unsigned char* p, int count)
+{
+    for (int i = 0; i < count; ++i, p += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(p, rgb);
+        p[0] = rgb[0] & 0xE0;
+        p[1] = rgb[1] & 0xE0;
+        p[2] = rgb[2] & 0xC0;
+    }
+}// Quant_Uniform_Row_Scalar
+
+
+static void Threshold_Row_Scalar(unsigned char* p, int count)
+{
+    for (int i = 0; i < count; ++i, p += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(p, rgb);
+        p[0] = p[1] = p[2] = rgb[0] >= 128 ? 255 : 0;
+    }
+}// Threshold_Row_Scalar
+
+
+static void Ordered_Row_Scalar(unsigned char* p, int count, const unsigned char* thresholds)
+{
+    for (int i = 0; i < count; ++i, p += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(p, rgb);
+        p[0] = p[1] = p[2] = rgb[0] > thresholds[i] ? 255 : 0;
+        p[3] = 255;
+    }
+}// Ordered_Row_Scalar
+
+
+static void Straighten_Row_Scalar(const unsigned char* in, unsigned char* out, int count)
+{
+    for (int i = 0; i < count; ++i, in += 4, out += 4)
+    {
+        if (in[3] == 255)
+        {
+            if (out != in)
+                memcpy(out, in, 4);
+            continue;
+        }
+        Unpremultiply_Pixel(in, out);
+        out[3] = in[3];
+    }
+}// Straighten_Row_Scalar
+
+
+static void Unpremultiply_Row_Scalar(const unsigned char* in, unsigned char* rgb, int count)
+{
+    for (int i = 0; i < count; ++i, in += 4, rgb += 3)
+    {
+        if (in[3] == 255)
+        {
+            rgb[0] = in[0];
+            rgb[1] = in[1];
+            rgb[2] = in[2];
+        }
+        else
+            Unpremultiply_Pixel(in, rgb);
+    }
+}// Unpremultiply_Row_Scalar
+
+
+static void Palette_Row_Scalar(unsigned char* p, int count, const unsigned int* cells)
+{
+    for (int i = 0; i < count; ++i, p += 4)
+    {
+        unsigned char rgb[3];
+        Unpremultiply_Pixel(p, rgb);
+
+        unsigned int color = cells[Color_Cell(rgb)];
+        p[0] = (unsigned char)color;
+        p[1] = (unsigned char)(color >> 8);
+        p[2] = (unsigned char)(color >> 16);
+    }
+}// Palette_Row_Scalar
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Porter-Duff compositing.  An operator weights F by a factor Fa of
+//  G's alpha and G by a factor Fb of F's alpha, so one template covers
+//  them all, each factor folding to a constant, a copy or one multiply.
+//  Products are x*a/255 rounded to the nearest integer, exactly, computed
+//  as (t + (t >> 8)) >> 8 with t = x*a + 128.
+//
+///////////////////////////////////////////////////////////////////////////////
+enum EFactor            // a Porter-Duff factor, in terms of the other image's alpha
+{
+    FACTOR_ZERO,
+    FACTOR_ONE,
+    FACTOR_ALPHA,
+    FACTOR_INVERSE      // 1 - alpha
+};// EFactor
+
+template <int op> struct PorterDuff;
+template <> struct PorterDuff<COMPOSITE_OVER>   { static const EFactor c_fa = FACTOR_ONE;       static const EFactor c_fb = FACTOR_INVERSE; };
+template <> struct PorterDuff<COMPOSITE_IN>     { static const EFactor c_fa = FACTOR_ALPHA;     static const EFactor c_fb = FACTOR_ZERO; };
+template <> struct PorterDuff<COMPOSITE_OUT>    { static const EFactor c_fa = FACTOR_INVERSE;   static const EFactor c_fb = FACTOR_ZERO; };
+template <> struct PorterDuff<COMPOSITE_ATOP>   { static const EFactor c_fa = FACTOR_ALPHA;     static const EFactor c_fb = FACTOR_INVERSE; };
+template <> struct PorterDuff<COMPOSITE_XOR>    { static const EFactor c_fa = FACTOR_INVERSE;   static const EFactor c_fb = FACTOR_INVERSE; };
+
+
+static inline int Mul_255(int x, int a)
+{
+    int t = x * a + 128;
+    return (t + (t >> 8)) >> 8;
+}// Mul_255
+
+
+template <EFactor factor>
+static inline int Scale(int x, int alpha)
+{
+    switch (factor)
+    {
+        case FACTOR_ZERO:   return 0;
+        case FACTOR_ONE:    return x;
+        case FACTOR_ALPHA:  return Mul_255(x, alpha);
+        default:            return Mul_255(x, 255 - alpha);
+    }
+}// Scale
+
+
+template <int op>
+static void Composite_Row_Scalar(const unsigned char* f, const unsigned char* g, unsigned char* out, int count)
+{
+    const EFactor Fa = PorterDuff<op>::c_fa;
+    const EFactor Fb = PorterDuff<op>::c_fb;
+
+    for (int i = 0; i < count; ++i, f += 4, g += 4, out += 4)
+    {
+        int alpha_f = f[3];
+        int alpha_g = g[3];
+
+        // each channel reads only its own, so out may be either input
+        for (int c = 0; c < 4; ++c)
+            out[c] = (unsigned char)Min(Scale<Fa>(f[c], alpha_g) + Scale<Fb>(g[c], alpha_f), 255);
+    }
+}// Composite_Row_Scalar
+
+
+// Compare pixels begin to count of the rows; the moment planes are count long.
+static void Compare_Pixels(const unsigned char* a, const unsigned char* b, int begin, int count,
+                           CompareSums& sums, unsigned int* moments)
+{
+    for (int i = begin; i < count; ++i)
+    {
+        const unsigned char*    pa = a + i * 4;
+        const unsigned char*    pb = b + i * 4;
+        int                     largest = 0;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            int difference = pa[c] > pb[c] ? pa[c] - pb[c] : pb[c] - pa[c];
+            if (c < 3)
+                sums.squared_error += difference * difference;
+            largest = Max(largest, difference);
+        }
+        sums.max_error = Max(sums.max_error, largest);
+        sums.mismatches += largest != 0;
+
+        unsigned int x = Luma(pa);
+        unsigned int y = Luma(pb);
+        moments[i] += x;
+        moments[count + i] += y;
+        moments[2 * count + i] += x * x;
+        moments[3 * count + i] += y * y;
+        moments[4 * count + i] += x * y;
+    }
+}// Compare_Pixels
+
+
+static void Compare_Row_Scalar(const unsigned char* a, const unsigned char* b, int count,
+                               CompareSums& sums, unsigned int* moments)
+{
+    Compare_Pixels(a, b, 0, count, sums, moments);
+}// Compare_Row_Scalar
+
+
+#ifdef PIXEL_KERNELS_X86
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSE2 kernels, 4 pixels at a time.  Luma is two madds per vector: red
+//  and blue sit in the two 16 bit halves of each pixel, green is put in
+//  both halves and weighted by half its weight, since the full green weight
+//  does not fit a signed 16 bit lane.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_SSE2 static inline bool All_Opaque(__m128i v, __m128i alpha)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha), alpha)) == 0xFFFF;
+}// All_Opaque
+
+
+TARGET_SSE2 static void Gray_Row_SSE2(unsigned char* p, int count)
+{
+    const __m128i alpha     = _mm_set1_epi32((int)0xFF000000);
+    const __m128i rb_mask   = _mm_set1_epi32(0x00FF00FF);
+    const __m128i lo_byte   = _mm_set1_epi32(0x000000FF);
+    const __m128i hi_byte   = _mm_set1_epi32(0x00FF0000);
+    const __m128i rb_weight = _mm_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m128i gg_weight = _mm_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Gray_Row_Scalar(p, 4);
+            continue;
+        }
+
+        __m128i rb = _mm_madd_epi16(_mm_and_si128(v, rb_mask), rb_weight);
+        __m128i gg = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 8), lo_byte),
+                                  _mm_and_si128(_mm_slli_epi32(v, 8), hi_byte));
+        __m128i y = _mm_srli_epi32(_mm_add_epi32(rb, _mm_madd_epi16(gg, gg_weight)), c_lumaShift);
+
+        y = _mm_or_si128(_mm_or_si128(y, _mm_slli_epi32(y, 8)), _mm_slli_epi32(y, 16));
+        _mm_storeu_si128((__m128i*)p, _mm_or_si128(y, alpha));
+    }
+    Gray_Row_Scalar(p, count - i);
+}// Gray_Row_SSE2
+
+
+TARGET_SSE2 static void Quant_Uniform_Row_SSE2(unsigned char* p, int count)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i keep  = _mm_set1_epi32((int)0xFFC0E0E0);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        if (!All_Opaque(v, alpha))
+            Quant_Uniform_Row_Scalar(p, 4);
+        else
+            _mm_storeu_si128((__m128i*)p, _mm_and_si128(v, keep));
+    }
+    Quant_Uniform_Row_Scalar(p, count - i);
+}// Quant_Uniform_Row_SSE2
+
+
+TARGET_SSE2 static void Threshold_Row_SSE2(unsigned char* p, int count)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i color = _mm_set1_epi32(0x00FFFFFF);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Threshold_Row_Scalar(p, 4);
+            continue;
+        }
+
+        // the top bit of red spread over the whole pixel
+        __m128i white = _mm_srai_epi32(_mm_slli_epi32(v, 24), 31);
+        _mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_and_si128(white, color), alpha));
+    }
+    Threshold_Row_Scalar(p, count - i);
+}// Threshold_Row_SSE2
+
+
+TARGET_SSE2 static void Ordered_Row_SSE2(unsigned char* p, int count, const unsigned char* thresholds)
+{
+    const __m128i alpha     = _mm_set1_epi32((int)0xFF000000);
+    const __m128i color     = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i lo_byte   = _mm_set1_epi32(0x000000FF);
+    const __m128i zero      = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Ordered_Row_Scalar(p, 4, thresholds + i);
+            continue;
+        }
+
+        int bytes;
+        memcpy(&bytes, thresholds + i, 4);
+        __m128i limit = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+        __m128i white = _mm_cmpgt_epi32(_mm_and_si128(v, lo_byte), limit);
+        _mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_and_si128(white, color), alpha));
+    }
+    Ordered_Row_Scalar(p, count - i, thresholds + i);
+}// Ordered_Row_SSE2
+
+
+// Straight color of the 4 pixels at p, alpha kept.  Each pixel is widened to
+// four floats and multiplied by (scale, scale, scale, 1), the same float
+// products as Unpremultiply_Pixel, and the saturating packs clamp to 255.
+TARGET_SSE2 static inline __m128i Straighten_SSE2(const unsigned char* p)
+{
+    const __m128i   zero = _mm_setzero_si128();
+    __m128i         v = _mm_loadu_si128((const __m128i*)p);
+    __m128i         lo = _mm_unpacklo_epi8(v, zero);
+    __m128i         hi = _mm_unpackhi_epi8(v, zero);
+    __m128i         q[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                             _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+
+    for (int k = 0; k < 4; ++k)
+    {
+        float   s = s_alphaScale[p[k * 4 + 3]];
+        __m128  f = _mm_mul_ps(_mm_cvtepi32_ps(q[k]), _mm_setr_ps(s, s, s, 1.0f));
+        q[k] = _mm_cvttps_epi32(f);
+    }
+    return _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+}// Straighten_SSE2
+
+
+TARGET_SSE2 static void Straighten_Row_SSE2(const unsigned char* in, unsigned char* out, int count)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, in += 16, out += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)in);
+        if (!All_Opaque(v, alpha))
+            _mm_storeu_si128((__m128i*)out, Straighten_SSE2(in));
+        else if (out != in)
+            _mm_storeu_si128((__m128i*)out, v);
+    }
+    Straighten_Row_Scalar(in, out, count - i);
+}// Straighten_Row_SSE2
+
+
+TARGET_SSE2 static void Unpremultiply_Row_SSE2(const unsigned char* in, unsigned char* rgb, int count)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, in += 16, rgb += 12)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)in);
+        if (!All_Opaque(v, alpha))
+            v = Straighten_SSE2(in);
+
+        // no byte shuffle before SSSE3, so pack the 4 pixels into 12 bytes
+        // with integer shifts, written as one 8 and one 4 byte store
+        unsigned int d0 = _mm_cvtsi128_si32(v);
+        unsigned int d1 = _mm_cvtsi128_si32(_mm_shuffle_epi32(v, 1));
+        unsigned int d2 = _mm_cvtsi128_si32(_mm_shuffle_epi32(v, 2));
+        unsigned int d3 = _mm_cvtsi128_si32(_mm_shuffle_epi32(v, 3));
+        unsigned long long lo = (d0 & 0x00FFFFFF) | ((unsigned long long)(d1 & 0x00FFFFFF) << 24) |
+                                ((unsigned long long)(d2 & 0xFFFF) << 48);
+        unsigned int hi = ((d2 >> 16) & 0xFF) | (d3 << 8);
+        memcpy(rgb, &lo, 8);
+        memcpy(rgb + 8, &hi, 4);
+    }
+    Unpremultiply_Row_Scalar(in, rgb, count - i);
+}// Unpremultiply_Row_SSE2
+
+
+// The cell of an opaque pixel is the top five bits of red, green and blue
+// moved to bits 10, 5 and 0.  There is no gather before AVX2, so the cells
+// come out of the vector for the lookups.
+TARGET_SSE2 static void Palette_Row_SSE2(unsigned char* p, int count, const unsigned int* cells)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i red   = _mm_set1_epi32(0x0000F8);
+    const __m128i green = _mm_set1_epi32(0x00F800);
+    const __m128i blue  = _mm_set1_epi32(0xF80000);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Palette_Row_Scalar(p, 4, cells);
+            continue;
+        }
+
+        __m128i index = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(v, red), 7),
+                                                  _mm_srli_epi32(_mm_and_si128(v, green), 6)),
+                                     _mm_srli_epi32(_mm_and_si128(v, blue), 19));
+        int cell[4];
+        _mm_storeu_si128((__m128i*)cell, index);
+        __m128i color = _mm_setr_epi32(cells[cell[0]], cells[cell[1]], cells[cell[2]], cells[cell[3]]);
+        _mm_storeu_si128((__m128i*)p, _mm_or_si128(color, alpha));
+    }
+    Palette_Row_Scalar(p, count - i, cells);
+}// Palette_Row_SSE2
+
+
+// Two pixels widened to 16 bits, scaled by a factor of the alpha of the
+// two in other.  The shuffles spread each alpha over its pixel's lanes.
+TARGET_SSE2 static inline __m128i Mul_255_SSE2(__m128i x, __m128i a)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}// Mul_255_SSE2
+
+
+template <EFactor factor>
+TARGET_SSE2 static inline __m128i Scale_SSE2(__m128i x, __m128i other)
+{
+    if (factor == FACTOR_ZERO)
+        return _mm_setzero_si128();
+    if (factor == FACTOR_ONE)
+        return x;
+
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(other, 0xFF), 0xFF);
+    if (factor == FACTOR_INVERSE)
+        alpha = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    return Mul_255_SSE2(x, alpha);
+}// Scale_SSE2
+
+
+template <int op>
+TARGET_SSE2 static void Composite_Row_SSE2(const unsigned char* f, const unsigned char* g, unsigned char* out, int count)
+{
+    const EFactor Fa = PorterDuff<op>::c_fa;
+    const EFactor Fb = PorterDuff<op>::c_fb;
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, f += 16, g += 16, out += 16)
+    {
+        __m128i vf = _mm_loadu_si128((const __m128i*)f);
+        __m128i vg = _mm_loadu_si128((const __m128i*)g);
+
+        __m128i f_lo = _mm_unpacklo_epi8(vf, zero);
+        __m128i f_hi = _mm_unpackhi_epi8(vf, zero);
+        __m128i g_lo = _mm_unpacklo_epi8(vg, zero);
+        __m128i g_hi = _mm_unpackhi_epi8(vg, zero);
+
+        __m128i lo = _mm_add_epi16(Scale_SSE2<Fa>(f_lo, g_lo), Scale_SSE2<Fb>(g_lo, f_lo));
+        __m128i hi = _mm_add_epi16(Scale_SSE2<Fa>(f_hi, g_hi), Scale_SSE2<Fb>(g_hi, f_hi));
+        _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(lo, hi));
+    }
+    Composite_Row_Scalar<op>(f, g, out, count - i);
+}// Composite_Row_SSE2
+
+
+// Luma of the 4 straight pixels in v, one per 32 bit lane; the arithmetic of
+// Gray_Row_SSE2.
+TARGET_SSE2 static inline __m128i Luma_SSE2(__m128i v)
+{
+    const __m128i rb_mask   = _mm_set1_epi32(0x00FF00FF);
+    const __m128i lo_byte   = _mm_set1_epi32(0x000000FF);
+    const __m128i hi_byte   = _mm_set1_epi32(0x00FF0000);
+    const __m128i rb_weight = _mm_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m128i gg_weight = _mm_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    __m128i rb = _mm_madd_epi16(_mm_and_si128(v, rb_mask), rb_weight);
+    __m128i gg = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 8), lo_byte),
+                              _mm_and_si128(_mm_slli_epi32(v, 8), hi_byte));
+    return _mm_srli_epi32(_mm_add_epi32(rb, _mm_madd_epi16(gg, gg_weight)), c_lumaShift);
+}// Luma_SSE2
+
+
+// Add v to the 4 unsigned ints at p.
+TARGET_SSE2 static inline void Accumulate_SSE2(unsigned int* p, __m128i v)
+{
+    _mm_storeu_si128((__m128i*)p, _mm_add_epi32(_mm_loadu_si128((const __m128i*)p), v));
+}// Accumulate_SSE2
+
+
+// Differences are the two saturating subtractions or'ed; squares of the
+// color ones are madds into 32 bit lanes, then added into 64 bit totals.
+// Equal pixels are counted by lane and the largest difference by byte, and
+// both are folded into sums at the end of the row.
+TARGET_SSE2 static void Compare_Row_SSE2(const unsigned char* a, const unsigned char* b, int count,
+                                         CompareSums& sums, unsigned int* moments)
+{
+    const __m128i color     = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i zero      = _mm_setzero_si128();
+
+    __m128i squared = zero;
+    __m128i largest = zero;
+    __m128i same = zero;
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i * 4));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i * 4));
+
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i rgb = _mm_and_si128(difference, color);
+        __m128i lo = _mm_unpacklo_epi8(rgb, zero);
+        __m128i hi = _mm_unpackhi_epi8(rgb, zero);
+        __m128i s = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi));
+
+        squared = _mm_add_epi64(squared, _mm_add_epi64(_mm_unpacklo_epi32(s, zero), _mm_unpackhi_epi32(s, zero)));
+        largest = _mm_max_epu8(largest, difference);
+        same = _mm_sub_epi32(same, _mm_cmpeq_epi32(va, vb));
+
+        __m128i x = Luma_SSE2(va);
+        __m128i y = Luma_SSE2(vb);
+        Accumulate_SSE2(moments + i, x);
+        Accumulate_SSE2(moments + count + i, y);
+        Accumulate_SSE2(moments + 2 * count + i, _mm_madd_epi16(x, x));
+        Accumulate_SSE2(moments + 3 * count + i, _mm_madd_epi16(y, y));
+        Accumulate_SSE2(moments + 4 * count + i, _mm_madd_epi16(x, y));
+    }
+
+    unsigned long long  squares[2];
+    unsigned char       bytes[16];
+    int                 lanes[4];
+    _mm_storeu_si128((__m128i*)squares, squared);
+    _mm_storeu_si128((__m128i*)bytes, largest);
+    _mm_storeu_si128((__m128i*)lanes, same);
+
+    sums.squared_error += squares[0] + squares[1];
+    for (int k = 0; k < 16; ++k)
+        sums.max_error = Max(sums.max_error, (int)bytes[k]);
+    sums.mismatches += i - (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+    Compare_Pixels(a, b, i, count, sums, moments);
+}// Compare_Row_SSE2
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX2 kernels, 8 pixels at a time.  Same arithmetic as SSE2.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX2 static inline bool All_Opaque(__m256i v, __m256i alpha)
+{
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(v, alpha), alpha)) == -1;
+}// All_Opaque
+
+
+TARGET_AVX2 static void Gray_Row_AVX2(unsigned char* p, int count)
+{
+    const __m256i alpha     = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i rb_mask   = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i lo_byte   = _mm256_set1_epi32(0x000000FF);
+    const __m256i hi_byte   = _mm256_set1_epi32(0x00FF0000);
+    const __m256i rb_weight = _mm256_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m256i gg_weight = _mm256_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Gray_Row_Scalar(p, 8);
+            continue;
+        }
+
+        __m256i rb = _mm256_madd_epi16(_mm256_and_si256(v, rb_mask), rb_weight);
+        __m256i gg = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 8), lo_byte),
+                                     _mm256_and_si256(_mm256_slli_epi32(v, 8), hi_byte));
+        __m256i y = _mm256_srli_epi32(_mm256_add_epi32(rb, _mm256_madd_epi16(gg, gg_weight)), c_lumaShift);
+
+        y = _mm256_or_si256(_mm256_or_si256(y, _mm256_slli_epi32(y, 8)), _mm256_slli_epi32(y, 16));
+        _mm256_storeu_si256((__m256i*)p, _mm256_or_si256(y, alpha));
+    }
+    Gray_Row_SSE2(p, count - i);
+}// Gray_Row_AVX2
+
+
+TARGET_AVX2 static void Quant_Uniform_Row_AVX2(unsigned char* p, int count)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i keep  = _mm256_set1_epi32((int)0xFFC0E0E0);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        if (!All_Opaque(v, alpha))
+            Quant_Uniform_Row_Scalar(p, 8);
+        else
+            _mm256_storeu_si256((__m256i*)p, _mm256_and_si256(v, keep));
+    }
+    Quant_Uniform_Row_SSE2(p, count - i);
+}// Quant_Uniform_Row_AVX2
+
+
+TARGET_AVX2 static void Threshold_Row_AVX2(unsigned char* p, int count)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i color = _mm256_set1_epi32(0x00FFFFFF);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Threshold_Row_Scalar(p, 8);
+            continue;
+        }
+
+        __m256i white = _mm256_srai_epi32(_mm256_slli_epi32(v, 24), 31);
+        _mm256_storeu_si256((__m256i*)p, _mm256_or_si256(_mm256_and_si256(white, color), alpha));
+    }
+    Threshold_Row_SSE2(p, count - i);
+}// Threshold_Row_AVX2
+
+
+TARGET_AVX2 static void Ordered_Row_AVX2(unsigned char* p, int count, const unsigned char* thresholds)
+{
+    const __m256i alpha     = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i color     = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i lo_byte   = _mm256_set1_epi32(0x000000FF);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Ordered_Row_Scalar(p, 8, thresholds + i);
+            continue;
+        }
+
+        __m256i limit = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(thresholds + i)));
+        __m256i white = _mm256_cmpgt_epi32(_mm256_and_si256(v, lo_byte), limit);
+        _mm256_storeu_si256((__m256i*)p, _mm256_or_si256(_mm256_and_si256(white, color), alpha));
+    }
+    Ordered_Row_SSE2(p, count - i, thresholds + i);
+}// Ordered_Row_AVX2
+
+
+// Straight color of the 8 pixels at p, alpha kept.  Two pixels per vector
+// of floats, the scales gathered from the table by the alpha in each lane,
+// and the alpha lanes put back from the input afterwards.
+TARGET_AVX2 static inline __m256i Straighten_AVX2(const unsigned char* p)
+{
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i q[4];
+
+    for (int k = 0; k < 4; ++k)
+    {
+        __m256i x = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(p + k * 8)));
+        __m256  s = _mm256_i32gather_ps(s_alphaScale, _mm256_shuffle_epi32(x, 0xFF), 4);
+        __m256i y = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(x), s));
+        q[k] = _mm256_blend_epi32(y, x, 0x88);
+    }
+
+    // the packs work within 128 bit lanes, leaving pixels 0 2 4 6 1 3 5 7
+    __m256i v = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+    return _mm256_permutevar8x32_epi32(v, order);
+}// Straighten_AVX2
+
+
+TARGET_AVX2 static void Straighten_Row_AVX2(const unsigned char* in, unsigned char* out, int count)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, in += 32, out += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)in);
+        if (!All_Opaque(v, alpha))
+            _mm256_storeu_si256((__m256i*)out, Straighten_AVX2(in));
+        else if (out != in)
+            _mm256_storeu_si256((__m256i*)out, v);
+    }
+    Straighten_Row_SSE2(in, out, count - i);
+}// Straighten_Row_AVX2
+
+
+TARGET_AVX2 static void Unpremultiply_Row_AVX2(const unsigned char* in, unsigned char* rgb, int count)
+{
+    const __m256i alpha     = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i drop      = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                               0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i close_up  = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, in += 32, rgb += 24)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)in);
+        if (!All_Opaque(v, alpha))
+            v = Straighten_AVX2(in);
+
+        // 12 bytes of rgb in each lane, then the two runs side by side
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, drop), close_up);
+        _mm_storeu_si128((__m128i*)rgb, _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i*)(rgb + 16), _mm256_extracti128_si256(v, 1));
+    }
+    Unpremultiply_Row_SSE2(in, rgb, count - i);
+}// Unpremultiply_Row_AVX2
+
+
+TARGET_AVX2 static void Palette_Row_AVX2(unsigned char* p, int count, const unsigned int* cells)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i red   = _mm256_set1_epi32(0x0000F8);
+    const __m256i green = _mm256_set1_epi32(0x00F800);
+    const __m256i blue  = _mm256_set1_epi32(0xF80000);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Palette_Row_Scalar(p, 8, cells);
+            continue;
+        }
+
+        __m256i cell = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(v, red), 7),
+                                                       _mm256_srli_epi32(_mm256_and_si256(v, green), 6)),
+                                       _mm256_srli_epi32(_mm256_and_si256(v, blue), 19));
+        __m256i color = _mm256_i32gather_epi32((const int*)cells, cell, 4);
+        _mm256_storeu_si256((__m256i*)p, _mm256_or_si256(color, alpha));
+    }
+    Palette_Row_SSE2(p, count - i, cells);
+}// Palette_Row_AVX2
+
+
+TARGET_AVX2 static inline __m256i Mul_255_AVX2(__m256i x, __m256i a)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}// Mul_255_AVX2
+
+
+template <EFactor factor>
+TARGET_AVX2 static inline __m256i Scale_AVX2(__m256i x, __m256i other)
+{
+    if (factor == FACTOR_ZERO)
+        return _mm256_setzero_si256();
+    if (factor == FACTOR_ONE)
+        return x;
+
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(other, 0xFF), 0xFF);
+    if (factor == FACTOR_INVERSE)
+        alpha = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    return Mul_255_AVX2(x, alpha);
+}// Scale_AVX2
+
+
+template <int op>
+TARGET_AVX2 static void Composite_Row_AVX2(const unsigned char* f, const unsigned char* g, unsigned char* out, int count)
+{
+    const EFactor Fa = PorterDuff<op>::c_fa;
+    const EFactor Fb = PorterDuff<op>::c_fb;
+    const __m256i zero = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8, f += 32, g += 32, out += 32)
+    {
+        __m256i vf = _mm256_loadu_si256((const __m256i*)f);
+        __m256i vg = _mm256_loadu_si256((const __m256i*)g);
+
+        __m256i f_lo = _mm256_unpacklo_epi8(vf, zero);
+        __m256i f_hi = _mm256_unpackhi_epi8(vf, zero);
+        __m256i g_lo = _mm256_unpacklo_epi8(vg, zero);
+        __m256i g_hi = _mm256_unpackhi_epi8(vg, zero);
+
+        __m256i lo = _mm256_add_epi16(Scale_AVX2<Fa>(f_lo, g_lo), Scale_AVX2<Fb>(g_lo, f_lo));
+        __m256i hi = _mm256_add_epi16(Scale_AVX2<Fa>(f_hi, g_hi), Scale_AVX2<Fb>(g_hi, f_hi));
+        _mm256_storeu_si256((__m256i*)out, _mm256_packus_epi16(lo, hi));
+    }
+    Composite_Row_SSE2<op>(f, g, out, count - i);
+}// Composite_Row_AVX2
+
+
+// Luma of 8 straight pixels, as Luma_SSE2.
+TARGET_AVX2 static inline __m256i Luma_AVX2(__m256i v)
+{
+    const __m256i rb_mask   = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i lo_byte   = _mm256_set1_epi32(0x000000FF);
+    const __m256i hi_byte   = _mm256_set1_epi32(0x00FF0000);
+    const __m256i rb_weight = _mm256_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m256i gg_weight = _mm256_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    __m256i rb = _mm256_madd_epi16(_mm256_and_si256(v, rb_mask), rb_weight);
+    __m256i gg = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 8), lo_byte),
+                                 _mm256_and_si256(_mm256_slli_epi32(v, 8), hi_byte));
+    return _mm256_srli_epi32(_mm256_add_epi32(rb, _mm256_madd_epi16(gg, gg_weight)), c_lumaShift);
+}// Luma_AVX2
+
+
+TARGET_AVX2 static inline void Accumulate_AVX2(unsigned int* p, __m256i v)
+{
+    _mm256_storeu_si256((__m256i*)p, _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)p), v));
+}// Accumulate_AVX2
+
+
+TARGET_AVX2 static void Compare_Row_AVX2(const unsigned char* a, const unsigned char* b, int count,
+                                         CompareSums& sums, unsigned int* moments)
+{
+    const __m256i color     = _mm256_set1_epi32(0x00FFFFFF);
+    const __m256i zero      = _mm256_setzero_si256();
+
+    __m256i squared = zero;
+    __m256i largest = zero;
+    __m256i same = zero;
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i * 4));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i * 4));
+
+        __m256i difference = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+        __m256i rgb = _mm256_and_si256(difference, color);
+        __m256i lo = _mm256_unpacklo_epi8(rgb, zero);
+        __m256i hi = _mm256_unpackhi_epi8(rgb, zero);
+        __m256i s = _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi));
+
+        squared = _mm256_add_epi64(squared, _mm256_add_epi64(_mm256_unpacklo_epi32(s, zero),
+                                                             _mm256_unpackhi_epi32(s, zero)));
+        largest = _mm256_max_epu8(largest, difference);
+        same = _mm256_sub_epi32(same, _mm256_cmpeq_epi32(va, vb));
+
+        __m256i x = Luma_AVX2(va);
+        __m256i y = Luma_AVX2(vb);
+        Accumulate_AVX2(moments + i, x);
+        Accumulate_AVX2(moments + count + i, y);
+        Accumulate_AVX2(moments + 2 * count + i, _mm256_madd_epi16(x, x));
+        Accumulate_AVX2(moments + 3 * count + i, _mm256_madd_epi16(y, y));
+        Accumulate_AVX2(moments + 4 * count + i, _mm256_madd_epi16(x, y));
+    }
+
+    unsigned long long  squares[4];
+    unsigned char       bytes[32];
+    int                 lanes[8];
+    _mm256_storeu_si256((__m256i*)squares, squared);
+    _mm256_storeu_si256((__m256i*)bytes, largest);
+    _mm256_storeu_si256((__m256i*)lanes, same);
+
+    sums.squared_error += squares[0] + squares[1] + squares[2] + squares[3];
+    for (int k = 0; k < 32; ++k)
+        sums.max_error = Max(sums.max_error, (int)bytes[k]);
+    for (int k = 0; k < 8; ++k)
+        sums.mismatches -= lanes[k];
+    sums.mismatches += i;
+
+    Compare_Pixels(a, b, i, count, sums, moments);
+}// Compare_Row_AVX2
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX-512 kernels, 16 pixels at a time.  Same arithmetic again, with
+//  mask registers for the compares and byte shuffles in place of the shifts.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET_AVX512 static inline bool All_Opaque(__m512i v, __m512i alpha)
+{
+    return _mm512_cmpneq_epi32_mask(_mm512_and_si512(v, alpha), alpha) == 0;
+}// All_Opaque
+
+
+TARGET_AVX512 static void Gray_Row_AVX512(unsigned char* p, int count)
+{
+    const __m512i alpha     = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i rb_mask   = _mm512_set1_epi32(0x00FF00FF);
+    // shuffles pick bytes within each 4 pixel lane: green into both 16 bit
+    // halves, and bits 16 to 23 of the weighted sum into r, g and b
+    const __m512i green     = _mm512_set4_epi32((int)0x800D800D, (int)0x80098009, (int)0x80058005, (int)0x80018001);
+    const __m512i luma      = _mm512_set4_epi32((int)0x800E0E0E, (int)0x800A0A0A, (int)0x80060606, (int)0x80020202);
+    const __m512i rb_weight = _mm512_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m512i gg_weight = _mm512_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Gray_Row_Scalar(p, 16);
+            continue;
+        }
+
+        __m512i rb = _mm512_madd_epi16(_mm512_and_si512(v, rb_mask), rb_weight);
+        __m512i gg = _mm512_shuffle_epi8(v, green);
+        __m512i y = _mm512_add_epi32(rb, _mm512_madd_epi16(gg, gg_weight));
+
+        _mm512_storeu_si512((void*)p, _mm512_or_si512(_mm512_shuffle_epi8(y, luma), alpha));
+    }
+    Gray_Row_AVX2(p, count - i);
+}// Gray_Row_AVX512
+
+
+TARGET_AVX512 static void Quant_Uniform_Row_AVX512(unsigned char* p, int count)
+{
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i keep  = _mm512_set1_epi32((int)0xFFC0E0E0);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        if (!All_Opaque(v, alpha))
+            Quant_Uniform_Row_Scalar(p, 16);
+        else
+            _mm512_storeu_si512((void*)p, _mm512_and_si512(v, keep));
+    }
+    Quant_Uniform_Row_AVX2(p, count - i);
+}// Quant_Uniform_Row_AVX512
+
+
+TARGET_AVX512 static void Threshold_Row_AVX512(unsigned char* p, int count)
+{
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i white = _mm512_set1_epi32((int)0xFFFFFFFF);
+    const __m512i half  = _mm512_set1_epi32(0x00000080);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Threshold_Row_Scalar(p, 16);
+            continue;
+        }
+
+        __mmask16 bright = _mm512_test_epi32_mask(v, half);
+        _mm512_storeu_si512((void*)p, _mm512_mask_blend_epi32(bright, alpha, white));
+    }
+    Threshold_Row_AVX2(p, count - i);
+}// Threshold_Row_AVX512
+
+
+TARGET_AVX512 static void Ordered_Row_AVX512(unsigned char* p, int count, const unsigned char* thresholds)
+{
+    const __m512i alpha     = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i white     = _mm512_set1_epi32((int)0xFFFFFFFF);
+    const __m512i lo_byte   = _mm512_set1_epi32(0x000000FF);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Ordered_Row_Scalar(p, 16, thresholds + i);
+            continue;
+        }
+
+        __m512i limit = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(thresholds + i)));
+        __mmask16 bright = _mm512_cmpgt_epi32_mask(_mm512_and_si512(v, lo_byte), limit);
+        _mm512_storeu_si512((void*)p, _mm512_mask_blend_epi32(bright, alpha, white));
+    }
+    Ordered_Row_AVX2(p, count - i, thresholds + i);
+}// Ordered_Row_AVX512
+
+// Translucent vectors go through the AVX2 conversion in two halves; the
+// gathers dominate there and a wider vector buys nothing.
+TARGET_AVX512 static void Straighten_Row_AVX512(const unsigned char* in, unsigned char* out, int count)
+{
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, in += 64, out += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)in);
+        if (!All_Opaque(v, alpha))
+            Straighten_Row_AVX2(in, out, 16);
+        else if (out != in)
+            _mm512_storeu_si512((void*)out, v);
+    }
+    Straighten_Row_AVX2(in, out, count - i);
+}// Straighten_Row_AVX512
+
+
+TARGET_AVX512 static void Unpremultiply_Row_AVX512(const unsigned char* in, unsigned char* rgb, int count)
+{
+    const __m512i   alpha       = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i   drop        = _mm512_set4_epi32(-1, 0x0E0D0C0A, 0x09080605, 0x04020100);
+    const __m512i   close_up    = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 3, 7, 11, 15);
+    const __mmask64 rgb_bytes   = 0x0000FFFFFFFFFFFFULL;
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, in += 64, rgb += 48)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)in);
+        if (!All_Opaque(v, alpha))
+        {
+            Unpremultiply_Row_AVX2(in, rgb, 16);
+            continue;
+        }
+
+        // the zero masked permute, since gcc warns about the plain one's undefined source
+        v = _mm512_maskz_permutexvar_epi32(0xFFFF, close_up, _mm512_shuffle_epi8(v, drop));
+        _mm512_mask_storeu_epi8((void*)rgb, rgb_bytes, v);
+    }
+    Unpremultiply_Row_AVX2(in, rgb, count - i);
+}// Unpremultiply_Row_AVX512
+
+
+TARGET_AVX512 static void Palette_Row_AVX512(unsigned char* p, int count, const unsigned int* cells)
+{
+    const __m512i alpha = _mm512_set1_epi32((int)0xFF000000);
+    const __m512i red   = _mm512_set1_epi32(0x0000F8);
+    const __m512i green = _mm512_set1_epi32(0x00F800);
+    const __m512i blue  = _mm512_set1_epi32(0xF80000);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, p += 64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)p);
+        if (!All_Opaque(v, alpha))
+        {
+            Palette_Row_Scalar(p, 16, cells);
+            continue;
+        }
+
+        // the zero masked shifts and gather, since gcc warns about the plain ones' undefined source
+        __m512i cell = _mm512_or_si512(_mm512_or_si512(_mm512_maskz_slli_epi32(0xFFFF, _mm512_and_si512(v, red), 7),
+                                                       _mm512_maskz_srli_epi32(0xFFFF, _mm512_and_si512(v, green), 6)),
+                                       _mm512_maskz_srli_epi32(0xFFFF, _mm512_and_si512(v, blue), 19));
+        __m512i color = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, cell, (const void*)cells, 4);
+        _mm512_storeu_si512((void*)p, _mm512_or_si512(color, alpha));
+    }
+    Palette_Row_AVX2(p, count - i, cells);
+}// Palette_Row_AVX512
+
+
+TARGET_AVX512 static inline __m512i Mul_255_AVX512(__m512i x, __m512i a)
+{
+    __m512i t = _mm512_add_epi16(_mm512_mullo_epi16(x, a), _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}// Mul_255_AVX512
+
+
+template <EFactor factor>
+TARGET_AVX512 static inline __m512i Scale_AVX512(__m512i x, __m512i other)
+{
+    if (factor == FACTOR_ZERO)
+        return _mm512_setzero_si512();
+    if (factor == FACTOR_ONE)
+        return x;
+
+    __m512i alpha = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(other, 0xFF), 0xFF);
+    if (factor == FACTOR_INVERSE)
+        alpha = _mm512_sub_epi16(_mm512_set1_epi16(255), alpha);
+    return Mul_255_AVX512(x, alpha);
+}// Scale_AVX512
+
+
+template <int op>
+TARGET_AVX512 static void Composite_Row_AVX512(const unsigned char* f, const unsigned char* g, unsigned char* out, int count)
+{
+    const EFactor Fa = PorterDuff<op>::c_fa;
+    const EFactor Fb = PorterDuff<op>::c_fb;
+    const __m512i zero = _mm512_setzero_si512();
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, f += 64, g += 64, out += 64)
+    {
+        __m512i vf = _mm512_loadu_si512((const void*)f);
+        __m512i vg = _mm512_loadu_si512((const void*)g);
+
+        __m512i f_lo = _mm512_unpacklo_epi8(vf, zero);
+        __m512i f_hi = _mm512_unpackhi_epi8(vf, zero);
+        __m512i g_lo = _mm512_unpacklo_epi8(vg, zero);
+        __m512i g_hi = _mm512_unpackhi_epi8(vg, zero);
+
+        __m512i lo = _mm512_add_epi16(Scale_AVX512<Fa>(f_lo, g_lo), Scale_AVX512<Fb>(g_lo, f_lo));
+        __m512i hi = _mm512_add_epi16(Scale_AVX512<Fa>(f_hi, g_hi), Scale_AVX512<Fb>(g_hi, f_hi));
+        _mm512_storeu_si512((void*)out, _mm512_packus_epi16(lo, hi));
+    }
+    Composite_Row_AVX2<op>(f, g, out, count - i);
+}// Composite_Row_AVX512
+
+
+// Luma of 16 straight pixels, as Luma_SSE2.
+TARGET_AVX512 static inline __m512i Luma_AVX512(__m512i v)
+{
+    const __m512i rb_mask   = _mm512_set1_epi32(0x00FF00FF);
+    const __m512i lo_byte   = _mm512_set1_epi32(0x000000FF);
+    const __m512i hi_byte   = _mm512_set1_epi32(0x00FF0000);
+    const __m512i rb_weight = _mm512_set1_epi32((c_lumaBlue << 16) | c_lumaRed);
+    const __m512i gg_weight = _mm512_set1_epi32(((c_lumaGreen / 2) << 16) | (c_lumaGreen / 2));
+
+    __m512i rb = _mm512_madd_epi16(_mm512_and_si512(v, rb_mask), rb_weight);
+    __m512i gg = _mm512_or_si512(_mm512_and_si512(_mm512_maskz_srli_epi32(0xFFFF, v, 8), lo_byte),
+                                 _mm512_and_si512(_mm512_maskz_slli_epi32(0xFFFF, v, 8), hi_byte));
+    return _mm512_maskz_srli_epi32(0xFFFF, _mm512_add_epi32(rb, _mm512_madd_epi16(gg, gg_weight)), c_lumaShift);
+}// Luma_AVX512
+
+
+TARGET_AVX512 static inline void Accumulate_AVX512(unsigned int* p, __m512i v)
+{
+    _mm512_storeu_si512((void*)p, _mm512_add_epi32(_mm512_loadu_si512((const void*)p), v));
+}// Accumulate_AVX512
+
+
+// Equal pixels come straight out of the compare as a mask.
+TARGET_AVX512 static void Compare_Row_AVX512(const unsigned char* a, const unsigned char* b, int count,
+                                           CompareSums& sums, unsigned int* moments)
+{
+    const __m512i color     = _mm512_set1_epi32(0x00FFFFFF);
+    const __m512i zero      = _mm512_setzero_si512();
+
+    __m512i     squared = zero;
+    __m512i     largest = zero;
+    long long   mismatches = 0;
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i va = _mm512_loadu_si512((const void*)(a + i * 4));
+        __m512i vb = _mm512_loadu_si512((const void*)(b + i * 4));
+
+        __m512i difference = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+        __m512i rgb = _mm512_and_si512(difference, color);
+        __m512i lo = _mm512_unpacklo_epi8(rgb, zero);
+        __m512i hi = _mm512_unpackhi_epi8(rgb, zero);
+        __m512i s = _mm512_add_epi32(_mm512_madd_epi16(lo, lo), _mm512_madd_epi16(hi, hi));
+
+        // the zero masked unpacks, since gcc warns about the plain ones' undefined source
+        squared = _mm512_add_epi64(squared, _mm512_add_epi64(_mm512_maskz_unpacklo_epi32(0xFFFF, s, zero),
+                                                             _mm512_maskz_unpackhi_epi32(0xFFFF, s, zero)));
+        largest = _mm512_max_epu8(largest, difference);
+
+        __mmask16 differ = _mm512_cmpneq_epi32_mask(va, vb);
+        for (; differ; differ &= differ - 1)
+            ++mismatches;
+
+        __m512i x = Luma_AVX512(va);
+        __m512i y = Luma_AVX512(vb);
+        Accumulate_AVX512(moments + i, x);
+        Accumulate_AVX512(moments + count + i, y);
+        Accumulate_AVX512(moments + 2 * count + i, _mm512_madd_epi16(x, x));
+        Accumulate_AVX512(moments + 3 * count + i, _mm512_madd_epi16(y, y));
+        Accumulate_AVX512(moments + 4 * count + i, _mm512_madd_epi16(x, y));
+    }
+
+    unsigned long long  squares[8];
+    unsigned char       bytes[64];
+    _mm512_storeu_si512((void*)squares, squared);
+    _mm512_storeu_si512((void*)bytes, largest);
+
+    for (int k = 0; k < 8; ++k)
+        sums.squared_error += squares[k];
+    for (int k = 0; k < 64; ++k)
+        sums.max_error = Max(sums.max_error, (int)bytes[k]);
+    sums.mismatches += mismatches;
+
+    Compare_Pixels(a, b, i, count, sums, moments);
+}// Compare_Row_AVX512
+
+#endif // PIXEL_KERNELS_X86
+
+
+// one Composite_Row per operator, in EPorterDuff order
+#define COMPOSITE_ROWS(kernel)  { kernel<COMPOSITE_OVER>, kernel<COMPOSITE_IN>, kernel<COMPOSITE_OUT>, \
+                                  kernel<COMPOSITE_ATOP>, kernel<COMPOSITE_XOR> }
+
+// kernel tables, indexed by ESimdLevel
+static const PixelKernels c_kernels[NUM_SIMD_LEVELS] =
+{
+    { SIMD_SCALAR, "scalar", Gray_Row_Scalar, Quant_Uniform_Row_Scalar, Threshold_Row_Scalar, Ordered_Row_Scalar,
+      Straighten_Row_Scalar, Unpremultiply_Row_Scalar, Palette_Row_Scalar,
+      COMPOSITE_ROWS(Composite_Row_Scalar), Compare_Row_Scalar },
+#ifdef PIXEL_KERNELS_X86
+    { SIMD_SSE2,   "sse2",   Gray_Row_SSE2,   Quant_Uniform_Row_SSE2,   Threshold_Row_SSE2,   Ordered_Row_SSE2,
+      Straighten_Row_SSE2,   Unpremultiply_Row_SSE2,   Palette_Row_SSE2,
+      COMPOSITE_ROWS(Composite_Row_SSE2), Compare_Row_SSE2 },
+    { SIMD_AVX2,   "avx2",   Gray_Row_AVX2,   Quant_Uniform_Row_AVX2,   Threshold_Row_AVX2,   Ordered_Row_AVX2,
+      Straighten_Row_AVX2,   Unpremultiply_Row_AVX2,   Palette_Row_AVX2,
+      COMPOSITE_ROWS(Composite_Row_AVX2), Compare_Row_AVX2 },
+    { SIMD_AVX512, "avx512", Gray_Row_AVX512, Quant_Uniform_Row_AVX512, Threshold_Row_AVX512, Ordered_Row_AVX512,
+      Straighten_Row_AVX512, Unpremultiply_Row_AVX512, Palette_Row_AVX512,
+      COMPOSITE_ROWS(Composite_Row_AVX512), Compare_Row_AVX512 },
+#else
+    { SIMD_SCALAR, "scalar", Gray_Row_Scalar, Quant_Uniform_Row_Scalar, Threshold_Row_Scalar, Ordered_Row_Scalar,
+      Straighten_Row_Scalar, Unpremultiply_Row_Scalar, Palette_Row_Scalar,
+      COMPOSITE_ROWS(Composite_Row_Scalar), Compare_Row_Scalar },
+    { SIMD_SCALAR, "scalar", Gray_Row_Scalar, Quant_Uniform_Row_Scalar, Threshold_Row_Scalar, Ordered_Row_Scalar,
+      Straighten_Row_Scalar, Unpremultiply_Row_Scalar, Palette_Row_Scalar,
+      COMPOSITE_ROWS(Composite_Row_Scalar), Compare_Row_Scalar },
+    { SIMD_SCALAR, "scalar", Gray_Row_Scalar, Quant_Uniform_Row_Scalar, Threshold_Row_Scalar, Ordered_Row_Scalar,
+      Straighten_Row_Scalar, Unpremultiply_Row_Scalar, Palette_Row_Scalar,
+      COMPOSITE_ROWS(Composite_Row_Scalar), Compare_Row_Scalar },
+#endif
+};
+
+static const PixelKernels* s_pKernels = NULL;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Best instruction set this CPU and OS can run.
+//
+///////////////////////////////////////////////////////////////////////////////
+ESimdLevel Best_Simd_Level()
+{
+#if defined(PIXEL_KERNELS_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SIMD_SSE2;
+#elif defined(PIXEL_KERNELS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+
+    if (max_leaf >= 7 && (xcr0 & 0x06) == 0x06)
+    {
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        bool avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+
+        if (avx512 && (xcr0 & 0xE0) == 0xE0)
+            return SIMD_AVX512;
+        if (avx2)
+            return SIMD_AVX2;
+    }
+    if (sse2)
+        return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}// Best_Simd_Level
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernels in use.  The first call picks the best the CPU supports.
+//
+///////////////////////////////////////////////////////////////////////////////
+const PixelKernels& Pixel_Kernels()
+{
+    if (!s_pKernels)
+        s_pKernels = &c_kernels[Best_Simd_Level()];
+    return *s_pKernels;
+}// Pixel_Kernels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Force a level, mainly to check the vector kernels against the scalar
+//  ones.  Fails, leaving the kernels alone, if the CPU can't run it.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool Set_Simd_Level(ESimdLevel level)
+{
+    if (level < SIMD_SCALAR || level > Best_Simd_Level())
+        return false;
+
+    s_pKernels = &c_kernels[level];
+    return true;
+}// Set_Simd_Level
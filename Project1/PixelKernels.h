@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PixelKernels.h                          Author:     Benjamin Reichert
+//
+//      Row kernels for the pointwise TargaImage operations.  Each kernel has
+//  a scalar reference version and SSE2, AVX2 and AVX-512 versions; the best
+//  one the CPU supports is picked the first time Pixel_Kernels is called.
+//  All versions give identical results.
+//
+//  The vector versions only handle fully opaque pixels, where premultiplied
+//  and straight color are the same.  Any vector holding a translucent pixel
+//  goes through the scalar code, except in the conversions to straight
+//  color, which divide out alpha in vector floats with the same products,
+//  and in compositing, which works on premultiplied color as it is.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PIXEL_KERNELS_H_
+#define _PIXEL_KERNELS_H_
+
+// fixed point luma weights, 0.299, 0.587 and 0.114 in 1/65536ths.  They sum
+// to 65536 so a gray pixel keeps its value.
+const int c_lumaShift   = 16;
+const int c_lumaRed     = 19595;
+const int c_lumaGreen   = 38470;
+const int c_lumaBlue    = 7471;
+
+const int c_colorCells  = 32 * 32 * 32;     // cells of the 5-5-5 color grid
+
+enum ESimdLevel         // instruction sets the kernels come in, in order
+{
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    NUM_SIMD_LEVELS
+};// ESimdLevel
+
+enum EPorterDuff        // compositing operators, image F op image G
+{
+    COMPOSITE_OVER,
+    COMPOSITE_IN,
+    COMPOSITE_OUT,
+    COMPOSITE_ATOP,
+    COMPOSITE_XOR,
+    NUM_COMPOSITE_OPERATORS
+};// EPorterDuff
+
+struct CompareSums      // running totals of Compare_Row
+{
+    unsigned long long  squared_error;      // over r, g and b
+    int                 max_error;          // largest difference of r, g, b or alpha
+    long long           mismatches;         // pixels with any channel different
+};// CompareSums
+
+struct PixelKernels
+{
+    ESimdLevel  level;
+    const char* name;
+
+    // set r, g and b to the luma of the straight color, alpha unchanged
+    void (*Gray_Row)(unsigned char* rgba, int count);
+
+    // keep the top 3 bits of red and green and the top 2 of blue
+    void (*Quant_Uniform_Row)(unsigned char* rgba, int count);
+
+    // gray pixels to white if the value is at least 128, black otherwise
+    void (*Threshold_Row)(unsigned char* rgba, int count);
+
+    // gray pixels to white if the value is greater than thresholds[x], black
+    // otherwise; alpha becomes opaque
+    void (*Ordered_Row)(unsigned char* rgba, int count, const unsigned char* thresholds);
+
+    // straight color of premultiplied pixels with alpha kept; out may be in
+    void (*Straighten_Row)(const unsigned char* in, unsigned char* out, int count);
+
+    // straight color of premultiplied pixels composited over black, packed rgb
+    void (*Unpremultiply_Row)(const unsigned char* rgba, unsigned char* rgb, int count);
+
+    // set r, g and b to cells[Color_Cell(straight color)], a color packed as
+    // 0x00bbggrr; alpha unchanged
+    void (*Palette_Row)(unsigned char* rgba, int count, const unsigned int* cells);
+
+    // out = f * Fa + g * Fb for premultiplied pixels, all four channels, with
+    // the factors of the operator; see PorterDuff in PixelKernels.cpp.  out
+    // may be f or g
+    void (*Composite_Row[NUM_COMPOSITE_OPERATORS])(const unsigned char* f, const unsigned char* g,
+                                                   unsigned char* out, int count);
+
+    // compare rows of straight color a and b, adding their differences to
+    // sums, and add the luma moments of each pixel to five planes of count
+    // in moments: a, b, a*a, b*b and a*b
+    void (*Compare_Row)(const unsigned char* a, const unsigned char* b, int count,
+                        CompareSums& sums, unsigned int* moments);
+};// PixelKernels
+
+
+const PixelKernels& Pixel_Kernels();                // kernels in use
+ESimdLevel          Best_Simd_Level();              // best level this CPU runs
+bool                Set_Simd_Level(ESimdLevel level);   // false if the CPU can't run it
+
+
+// Straight color of a premultiplied pixel, composited over black.
+void Unpremultiply_Pixel(const unsigned char* rgba, unsigned char* rgb);
+
+
+// Cell of a color in the 5-5-5 grid, 32 shades of each primary.
+inline int Color_Cell(const unsigned char* rgb)
+{
+    return (rgb[0] >> 3) << 10 | (rgb[1] >> 3) << 5 | rgb[2] >> 3;
+}// Color_Cell
+
+#endif
@@ -14,7 +14,16 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <stdio.h>
+#include <vector>
+#include <chrono>
 #include "TargaImage.h"
+#include "ThreadPool.h"
+#include "PixelKernels.h"
+#include "Convolution.h"
+#include "ColorOctree.h"
+#include "OrderedDither.h"
+#include "ImageMetrics.h"
 
 using namespace std;
 
@@ -27,19 +36,27 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "gray",
                                             "quant-unif",
                                             "quant-pop",
+                                            "quant-med",
+                                            "quant-octree",
                                             "dither-thresh",
                                             "dither-rand",
                                             "dither-fs",
+                                            "dither-jarvis",
+                                            "dither-stucki",
+                                            "dither-burkes",
+                                            "dither-atkinson",
                                             "dither-bright",
                                             "dither-cluster",
 					    "dither-pattern",
 					    "dither-color",
                                             "filter-box",
+                                            "filter-box-n",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
                                             "filter-edge",
                                             "filter-enhance",
+                                            "filter-kernel",
                                             "npr-paint",
                                             "half",
                                             "double",
@@ -49,9 +66,16 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-out",
                                             "comp-atop",
                                             "comp-xor",
+                                            "comp-region",
                                             "diff",
-                                            "rotate"
+                                            "metrics",
+                                            "rotate",
+                                            "time",
+                                            "threads",
+                                            "simd"
                                           };
+const char      c_asSimdLevels[][8]     = { "scalar", "sse2", "avx2", "avx512" };   // simd levels, by ESimdLevel
+const char      c_asOperators[][8]      = { "over", "in", "out", "atop", "xor" };   // compositing operators, by EPorterDuff
 
 enum ECommands          // command ids
 {
@@ -61,19 +85,27 @@ enum ECommands          // command ids
     GREY,
     QUANT_UNIF,
     QUANT_POP,
+    QUANT_MED,
+    QUANT_OCTREE,
     DITHER_THRESH,
     DITHER_RAND,
     DITHER_FS,
+    DITHER_JARVIS,
+    DITHER_STUCKI,
+    DITHER_BURKES,
+    DITHER_ATKINSON,
     DITHER_BRIGHT,
     DITHER_CLUSTER,
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_N,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
     FILTER_EDGE,
     FILTER_ENHANCE,
+    FILTER_KERNEL,
     NPR_PAINT,
     HALF,
     DOUBLE,
@@ -83,12 +115,47 @@ enum ECommands          // command ids
     COMP_OUT,
     COMP_ATOP,
     COMP_XOR,
+    COMP_REGION,
     DIFF,
+    METRICS,
     ROTATE,
+    TIME,
+    THREADS,
+    SIMD,
     NUM_COMMANDS
 };// ECommands
 
 
+// Read the scan order that may follow an error diffusion command.  False if
+// there is something else there.
+static bool Parse_Scan(bool& serpentine)
+{
+    char *sScan = strtok(NULL, c_sWhiteSpace);
+
+    serpentine = sScan && !strcmp(sScan, "serpentine");
+    if (sScan && !serpentine)
+    {
+        cout << "Scan must be \"serpentine\" or left out." << endl;
+        return false;
+    }// if
+    return true;
+}// Parse_Scan
+
+
+// Read a whole number argument.  False if it is not a number, or if it is
+// missing and not optional; a missing argument leaves value alone.
+static bool Parse_Int(int& value, bool optional = false)
+{
+    char *sValue = strtok(NULL, c_sWhiteSpace);
+    char *sEnd = sValue;
+
+    if (!sValue)
+        return optional;
+    value = (int)strtol(sValue, &sEnd, 10);
+    return sEnd != sValue && !*sEnd;
+}// Parse_Int
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Execute the given command string on the given image.  If the command
@@ -112,7 +179,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != THREADS && command != SIMD && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -178,6 +245,32 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// QUANT_POP
 
+        case QUANT_MED:
+        {
+            bResult = pImage->Quant_Median();
+            break;
+        }// QUANT_MED
+
+        case QUANT_OCTREE:
+        {
+            int colors = 0;
+            int depth = c_maxOctreeDepth;
+
+            if (!Parse_Int(colors) || colors < 1 || colors > c_maxOctreeColors)
+            {
+                cout << "Colors must be between 1 and " << c_maxOctreeColors << "." << endl;
+                bResult = bParsed = false;
+            }// if
+            else if (!Parse_Int(depth, true) || depth < 1 || depth > c_maxOctreeDepth)
+            {
+                cout << "Depth must be between 1 and " << c_maxOctreeDepth << "." << endl;
+                bResult = bParsed = false;
+            }// else if
+            else
+                bResult = pImage->Quant_Octree(colors, depth);
+            break;
+        }// QUANT_OCTREE
+
         case DITHER_THRESH:
         {
             bResult = pImage->Dither_Threshold();
@@ -186,16 +279,70 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case DITHER_RAND:
         {
-            bResult = pImage->Dither_Random();
+            char *sSeed = strtok(NULL, c_sWhiteSpace);
+            char *sEnd = sSeed;
+            unsigned long seed = sSeed ? strtoul(sSeed, &sEnd, 0) : 0;
+
+            if (sSeed && (*sEnd || sEnd == sSeed))
+            {
+                cout << "Seed must be a whole number." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Dither_Random((unsigned int)seed);
             break;
         }// DITHER_RAND
 
         case DITHER_FS:
         {
-            bResult = pImage->Dither_FS();
+            bool serpentine;
+            if (!Parse_Scan(serpentine))
+                bResult = bParsed = false;
+            else
+                bResult = pImage->Dither_FS(serpentine);
             break;
         }// DITHER_FS
 
+        case DITHER_JARVIS:
+        {
+            bool serpentine;
+            if (!Parse_Scan(serpentine))
+                bResult = bParsed = false;
+            else
+                bResult = pImage->Dither_Jarvis(serpentine);
+            break;
+        }// DITHER_JARVIS
+
+        case DITHER_STUCKI:
+        {
+            bool serpentine;
+            if (!Parse_Scan(serpentine))
+                bResult = bParsed = false;
+            else
+                bResult = pImage->Dither_Stucki(serpentine);
+            break;
+        }// DITHER_STUCKI
+
+        case DITHER_BURKES:
+        {
+            bool serpentine;
+            if (!Parse_Scan(serpentine))
+                bResult = bParsed = false;
+            else
+                bResult = pImage->Dither_Burkes(serpentine);
+            break;
+        }// DITHER_BURKES
+
+        case DITHER_ATKINSON:
+        {
+            bool serpentine;
+            if (!Parse_Scan(serpentine))
+                bResult = bParsed = false;
+            else
+                bResult = pImage->Dither_Atkinson(serpentine);
+            break;
+        }// DITHER_ATKINSON
+
         case DITHER_BRIGHT:
         {
             bResult = pImage->Dither_Bright();
@@ -208,6 +355,44 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_CLUSTER
         
+        case DITHER_PATTERN:
+        {
+            char* sPattern = strtok(NULL, c_sWhiteSpace);
+
+            if (!sPattern)
+            {
+                cout << "No pattern given." << endl;
+                bResult = bParsed = false;
+            }// if
+            else if (!strcmp(sPattern, "cluster"))
+                bResult = pImage->Dither_Pattern(ThresholdMatrix::Cluster());
+            else if (!strcmp(sPattern, "bayer"))
+            {
+                int size = 8;
+
+                if (!Parse_Int(size, true) || size < 2 || size > c_maxBayerSize || (size & (size - 1)))
+                {
+                    cout << "Bayer size must be 2, 4, 8 or 16." << endl;
+                    bResult = bParsed = false;
+                }// if
+                else
+                    bResult = pImage->Dither_Pattern(ThresholdMatrix::Bayer(size));
+            }// else if
+            else
+            {
+                TargaImage* pTile = TargaImage::Load_Image(sPattern);
+                if (!pTile || !pTile->data)
+                {
+                    cout << "Unable to load image:  " << sPattern << endl;
+                    bResult = bParsed = false;
+                }// if
+                else
+                    bResult = pImage->Dither_Pattern(ThresholdMatrix::From_Pixels(pTile->data, pTile->width, pTile->height));
+                delete pTile;
+            }// else
+            break;
+        }// DITHER_PATTERN
+
         case DITHER_COLOR:
         {
             bResult = pImage->Dither_Color();
@@ -220,6 +405,20 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_N:
+        {
+            int radius = -1;
+
+            if (!Parse_Int(radius) || radius < 0 || radius > c_maxBoxRadius)
+            {
+                cout << "Radius must be between 0 and " << c_maxBoxRadius << "." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box_N(radius);
+            break;
+        }// FILTER_BOX_N
+
         case FILTER_BARTLETT:
         {
             bResult = pImage->Filter_Bartlett();
@@ -256,6 +455,38 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// FILTER_ENHANCE
 
+        case FILTER_KERNEL:
+        {
+            // the file holds the size followed by size x size weights, row major
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            ifstream inFile;
+            if (sFilename)
+                inFile.open(sFilename);
+
+            int size = 0;
+            vector<double> weights;
+            if (inFile.is_open() && inFile >> size && size > 0 && size % 2 == 1)
+            {
+                weights.resize(size * size);
+                for (int i = 0; i < size * size && inFile >> weights[i]; ++i)
+                    ;
+            }// if
+
+            if (!sFilename)
+            {
+                cout << "No filename given." << endl;
+                bResult = bParsed = false;
+            }// if
+            else if (!inFile || weights.empty())
+            {
+                cout << "Unable to read kernel:  " << sFilename << endl;
+                bResult = bParsed = false;
+            }// else if
+            else
+                bResult = pImage->Apply_Filter_To_Image(&weights[0], size);
+            break;
+        }// FILTER_KERNEL
+
         case NPR_PAINT:
         {
             bResult = pImage->NPR_Paint();
@@ -379,6 +610,54 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// COMP_XOR
 
+        case COMP_REGION:
+        {
+            char* sOperator = strtok(NULL, c_sWhiteSpace);
+            int op = 0;
+            while (op < NUM_COMPOSITE_OPERATORS && (!sOperator || strcmp(sOperator, c_asOperators[op])))
+                ++op;
+
+            char*       sFilename = strtok(NULL, c_sWhiteSpace);
+            int         x, y;
+            ImageRect   rects[2];               // source, clip
+            bool        abGiven[2] = { false, false };
+            bool        bArgs = Parse_Int(x) && Parse_Int(y);
+
+            for (char* sRect = strtok(NULL, c_sWhiteSpace); bArgs && sRect; sRect = strtok(NULL, c_sWhiteSpace))
+            {
+                int which = !strcmp(sRect, "source") ? 0 : !strcmp(sRect, "clip") ? 1 : -1;
+                bArgs = which >= 0 && Parse_Int(rects[which].x) && Parse_Int(rects[which].y) &&
+                        Parse_Int(rects[which].width) && Parse_Int(rects[which].height);
+                if (bArgs)
+                    abGiven[which] = true;
+            }// for
+
+            if (op == NUM_COMPOSITE_OPERATORS)
+            {
+                cout << "Operator must be over, in, out, atop or xor." << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+            if (!sFilename || !bArgs)
+            {
+                cout << "Usage:  comp-region <op> <file> <x> <y> [source <x> <y> <width> <height>] "
+                        "[clip <x> <y> <width> <height>]" << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            if (!pNewImage)
+            {
+                cout << "Unable to load image:  " << sFilename << endl;
+                bParsed = false;
+            }// if
+            bResult = pNewImage && pImage->Comp_Region(pNewImage, (EPorterDuff)op, x, y,
+                                                       abGiven[0] ? &rects[0] : NULL, abGiven[1] ? &rects[1] : NULL);
+            delete pNewImage;
+            break;
+        }// COMP_REGION
+
         case DIFF:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
@@ -397,6 +676,32 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DIFF
 
+        case METRICS:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            TargaImage* pNewImage = TargaImage::Load_Image(sFilename);
+            ImageMetrics metrics;
+
+            if (!pNewImage)
+            {
+                if (sFilename)
+                    cout << "Unable to load image:  " << sFilename << endl;
+                bParsed = false;
+            }// if
+            bResult = pNewImage && pImage->Metrics(pNewImage, metrics);
+            delete pNewImage;
+
+            // one line of name=value pairs, for scripts to read
+            if (bResult)
+            {
+                char sLine[256];
+                snprintf(sLine, sizeof(sLine), "metrics mse=%.6f psnr=%.4f max=%d mismatched=%lld ssim=%.6f",
+                         metrics.mse, metrics.psnr, metrics.max_error, metrics.mismatches, metrics.ssim);
+                cout << sLine << endl;
+            }// if
+            break;
+        }// METRICS
+
         case ROTATE:
         {
             char *sAngle = strtok(NULL, c_sWhiteSpace);
@@ -414,6 +719,94 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case TIME:
+        {
+            int runs = 0;
+            bool bRuns = Parse_Int(runs);
+            char *sTimed = strtok(NULL, "");                // the rest of the line
+            char sName[32] = "";
+
+            if (!bRuns || runs < 1 || !sTimed || sscanf(sTimed, "%31s", sName) != 1)
+            {
+                cout << "Usage:  time <runs> <command>" << endl;
+                bResult = bParsed = false;
+                break;
+            }// if
+
+            // every run starts from a copy of the image so they all do the
+            // same work; the fastest is reported and the last one kept
+            double      megapixels = (double)pImage->width * pImage->height / 1e6;
+            double      best = 0;
+            TargaImage* pResult = NULL;
+
+            for (int run = 0; run < runs && bParsed; ++run)
+            {
+                TargaImage* pCopy = new TargaImage(*pImage);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                bParsed = HandleCommand(sTimed, pCopy);
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+                if (!run || seconds < best)
+                    best = seconds;
+                delete pResult;
+                pResult = pCopy;
+            }// for
+
+            delete pImage;
+            pImage = pResult;
+            bResult = bParsed;
+
+            // one line of name=value pairs, for scripts to read
+            if (bResult)
+            {
+                char sLine[256];
+                snprintf(sLine, sizeof(sLine), "time command=%s runs=%d ms=%.3f mps=%.1f",
+                         sName, runs, best * 1000, best > 0 ? megapixels / best : 0.0);
+                cout << sLine << endl;
+            }// if
+            break;
+        }// TIME
+
+        case THREADS:
+        {
+            int count;
+
+            if (!Parse_Int(count))
+            {
+                cout << "Thread count must be a number, 0 for one per core." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                ThreadPool::Instance().Set_Thread_Count(count);
+                bResult = true;
+            }// else
+            break;
+        }// THREADS
+
+        case SIMD:
+        {
+            char *sLevel = strtok(NULL, c_sWhiteSpace);
+            int level = NUM_SIMD_LEVELS;
+
+            if (sLevel && !strcmp(sLevel, "auto"))
+                level = Best_Simd_Level();
+            else if (sLevel)
+                for (level = 0; level < NUM_SIMD_LEVELS; ++level)
+                    if (!strcmp(sLevel, c_asSimdLevels[level]))
+                        break;
+
+            if (level == NUM_SIMD_LEVELS || !Set_Simd_Level((ESimdLevel)level))
+            {
+                cout << "Invalid or unsupported simd level." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = true;
+            break;
+        }// SIMD
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -14,6 +14,15 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "Convolution.h"
+#include "ThreadPool.h"
+#include "PixelKernels.h"
+#include "Histogram.h"
+#include "ColorOctree.h"
+#include "PaletteLookup.h"
+#include "ErrorDiffusion.h"
+#include "OrderedDither.h"
+#include "ImageMetrics.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
@@ -22,7 +31,6 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
-#include <time.h>
 
 using namespace std;
 
@@ -31,6 +39,153 @@ const int           RED             = 0;                // red channel
 const int           GREEN           = 1;                // green channel
 const int           BLUE            = 2;                // blue channel
 const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const unsigned int  c_maxExactGaussian = 7;             // largest N filtered with the exact binomial kernel
+const int           c_minFftTaps    = 56;               // multiplies per pixel from which the FFT beats spatial convolution
+const int           c_paletteColors = 256;              // colors the palette quantizers choose
+const tga_layout    c_imageLayout   = { 1, 0 };         // how image data sits in memory: top row first, rows packed
+
+
+// Pixel buffers are freed with delete[], so the loader allocates them with new[].
+static void* Allocate_Pixels(size_t bytes)
+{
+    return new unsigned char[bytes];
+}// Allocate_Pixels
+
+
+// Hash of a 32 bit key with every bit of the key affecting every bit of the
+// hash; a counter through it gives independent uniform random numbers.
+static inline unsigned int Hash_32(unsigned int key)
+{
+    key ^= key >> 16;
+    key *= 0x7FEB352D;
+    key ^= key >> 15;
+    key *= 0x846CA68B;
+    key ^= key >> 16;
+    return key;
+}// Hash_32
+
+
+// Count the straight colors of an image into the cells of the 5-5-5 histogram.
+static void Count_Color_Cells(const unsigned char* data, int width, int height, Histogram& cells)
+{
+    const PixelKernels& kernels = Pixel_Kernels();
+
+    cells.Build(height, [&](int y_begin, int y_end, unsigned int* bins)
+    {
+        vector<unsigned char> rgb(width * 3);
+
+        for (int y = y_begin; y < y_end; y++)
+        {
+            kernels.Unpremultiply_Row(data + y * width * 4, &rgb[0], width);
+            for (int x = 0; x < width; x++)
+                bins[Color_Cell(&rgb[x * 3])]++;
+        }
+    });
+}// Count_Color_Cells
+
+
+// Replace every pixel's color with the palette color nearest its cell.
+static void Map_To_Palette(unsigned char* data, int width, int height, const vector<unsigned char>& palette)
+{
+    PaletteLookup lookup(palette);
+
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        for (int y = y_begin; y < y_end; y++)
+            lookup.Map_Row(data + y * width * 4, width);
+    });
+}// Map_To_Palette
+
+
+// A distinct color of the image and how many pixels have it.
+struct WeightedColor
+{
+    unsigned char   rgb[3];
+    unsigned int    weight;
+};// WeightedColor
+
+
+// A box of median cut: colors [begin, end) of the list and their bounds.
+struct ColorBox
+{
+    int             begin, end;
+    double          weight;
+    unsigned char   low[3], high[3];
+};// ColorBox
+
+
+// Set a box's weight and bounds from the colors it holds.
+static void Fit_Box(const vector<WeightedColor>& colors, ColorBox& box)
+{
+    box.weight = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        box.low[c] = 255;
+        box.high[c] = 0;
+    }
+
+    for (int i = box.begin; i < box.end; i++)
+    {
+        box.weight += colors[i].weight;
+        for (int c = 0; c < 3; c++)
+        {
+            box.low[c] = Min(box.low[c], colors[i].rgb[c]);
+            box.high[c] = Max(box.high[c], colors[i].rgb[c]);
+        }
+    }
+}// Fit_Box
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Reorder colors [begin, end) in place so the ones before the returned
+//  index are no greater on axis than the ones after, and hold half the
+//  weight.  Like nth_element, but the position sought is a weight: each
+//  round partitions around a pivot three ways and keeps only the side the
+//  halfway weight falls in.  Both sides are left with at least one color.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int Split_At_Weighted_Median(vector<WeightedColor>& colors, int begin, int end, int axis, double weight)
+{
+    vector<WeightedColor>::iterator first = colors.begin();
+    double  need = weight / 2;                  // weight still to put on the low side
+    int     low = begin, high = end;
+
+    while (high - low > 1)
+    {
+        unsigned char pivot = colors[low + (high - low) / 2].rgb[axis];
+
+        int below = (int)(partition(first + low, first + high,
+                        [&](const WeightedColor& c) { return c.rgb[axis] < pivot; }) - first);
+        int equal = (int)(partition(first + below, first + high,
+                        [&](const WeightedColor& c) { return c.rgb[axis] == pivot; }) - first);
+
+        double below_weight = 0, equal_weight = 0;
+        for (int i = low; i < below; i++)
+            below_weight += colors[i].weight;
+        for (int i = below; i < equal; i++)
+            equal_weight += colors[i].weight;
+
+        if (need <= below_weight)
+            high = below;
+        else if (need <= below_weight + equal_weight)
+        {
+            // the middle falls among colors level on this axis, split between them
+            need -= below_weight;
+            low = below;
+            while (need > 0 && low < equal)
+                need -= colors[low++].weight;
+            return Max(begin + 1, Min(low, end - 1));
+        }
+        else
+        {
+            need -= below_weight + equal_weight;
+            low = equal;
+        }
+    }
+
+    return Max(begin + 1, Min(low + 1, end - 1));
+}// Split_At_Weighted_Median
 
 
 // Computes n choose s, efficiently
@@ -122,23 +277,17 @@ TargaImage::~TargaImage()
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::To_RGB(void)
 {
-    unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
-
     if (! data)
 	    return NULL;
 
+    unsigned char       *rgb = new unsigned char[width * height * 3];
+    const PixelKernels& kernels = Pixel_Kernels();
+
     // Divide out the alpha
-    for (i = 0 ; i < height ; i++)
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
     {
-	    int in_offset = i * width * 4;
-	    int out_offset = i * width * 3;
-
-	    for (j = 0 ; j < width ; j++)
-        {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
-    }
+        kernels.Unpremultiply_Row(data + y_begin * width * 4, rgb + y_begin * width * 3, (y_end - y_begin) * width);
+    });
 
     return rgb;
 }// TargaImage
@@ -147,23 +296,20 @@ unsigned char* TargaImage::To_RGB(void)
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//  The writer reads the rows top down from data, so nothing is copied.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Save_Image(const char *filename)
 {
-    TargaImage	*out_image = Reverse_Rows();
-
-    if (! out_image)
+    if (! data)
 	    return false;
 
-    if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
+    if (!tga_write_raw_layout(filename, width, height, data, TGA_TRUECOLOR_32, &c_imageLayout))
     {
-	    cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
+	    cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
 	    return false;
     }
 
-    delete out_image;
-
     return true;
 }// Save_Image
 
@@ -171,13 +317,13 @@ bool TargaImage::Save_Image(const char *filename)
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Load a targa image from a file.  Return a new TargaImage object which 
-//  must be deleted by caller.  Return NULL on failure.
+//  must be deleted by caller.  Return NULL on failure.  The file is decoded
+//  straight into the image's own buffer, flipped to top down on the way.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Load_Image(char *filename)
 {
     unsigned char   *temp_data;
-    TargaImage	    *temp_image;
     TargaImage	    *result;
     int		        width, height;
 
@@ -187,19 +333,20 @@ TargaImage* TargaImage::Load_Image(char *filename)
         return NULL;
     }// if
 
-    temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
+    temp_data = (unsigned char*)tga_load_layout(filename, &width, &height, TGA_TRUECOLOR_32,
+                                                &c_imageLayout, Allocate_Pixels);
     if (!temp_data)
     {
-        cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
+        cout << "TGA Error: " << tga_error_string(tga_get_last_error()) << endl;
 	    width = height = 0;
 	    return NULL;
     }
-    temp_image = new TargaImage(width, height, temp_data);
-    free(temp_data);
-
-    result = temp_image->Reverse_Rows();
 
-    delete temp_image;
+    // adopt the decoded buffer
+    result = new TargaImage();
+    result->width = width;
+    result->height = height;
+    result->data = temp_data;
 
     return result;
 }// Load_Image
@@ -222,18 +369,15 @@ bool TargaImage::To_Grayscale()
     // Use the formula I = 0.299r + 0.587g + 0.114b to convert color images to grayscale. 
     // This will be a key pre-requisite for many other operations. This operation should not affect alpha in any way. 
 
-    for(int i = 0; i < width * height * 4; i += 4){
-      // char is 8 bits/1byte in c++
-      unsigned char gray_pixel;
-      unsigned char rgb[3];
-      // Remove Alpha Channel since we don't need to change it
-      RGBA_To_RGB(data + i, rgb); 
-      gray_pixel = (unsigned char)(0.299*(float)rgb[0] + 0.587*(float)rgb[1] + 0.114*(float)rgb[2]);
-      // reassign pixels to new grayscale color
-      data[i] = gray_pixel;
-      data[i+1] = gray_pixel;
-      data[i+2] = gray_pixel;
-    }
+    // The weights are fixed point (see PixelKernels.h) so the vector kernels
+    // and the scalar one agree exactly.
+    const PixelKernels& kernels = Pixel_Kernels();
+
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        for(int y = y_begin; y < y_end; y++)
+          kernels.Gray_Row(data + y * width * 4, width);
+    });
 
     return true;
 
@@ -261,17 +405,15 @@ All of these operations assume that the current image has 24 bits of color infor
     Use the uniform quantization algorithm to convert the current image from a 24 bit color image to an 8 bit color image. Use 4 levels of blue, 8 levels of red, and 8 levels of green in the quantized image. 
     */
 
-    for(int i = 0; i < width * height * 4; i += 4){
-      unsigned char rgb[3];
-      // Remove Alpha Channel since we don't need to change it
-      RGBA_To_RGB(data + i, rgb); 
-      // Want to keep the upper bits, so we do some shifting and masking.
-      //take 8 bits, subtract 3 bits, shift which gives us the opposite mask we want, so then we bitwise not it.
-      //which gives us a lower 5 bit mask. We can then mask off the lower 5 bits, and only use the upper 3/2 bits. 
-      data[i] = rgb[0] & (~((1 << (8-3))-1));
-      data[i+1] = rgb[1] & (~((1 << (8-3))-1));
-      data[i+2] = rgb[2] & (~((1 << (8-2))-1));
-    }
+    // Want to keep the upper bits, so the kernel masks off the lower 5 bits of red and
+    // green and the lower 6 of blue, leaving the upper 3/2 bits.
+    const PixelKernels& kernels = Pixel_Kernels();
+
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        for(int y = y_begin; y < y_end; y++)
+          kernels.Quant_Uniform_Row(data + y * width * 4, width);
+    });
 
     return true;
 }// Quant_Uniform
@@ -285,11 +427,167 @@ All of these operations assume that the current image has 24 bits of color infor
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity()
 {
-    ClearToBlack();
-    return false;
+    if(!data){
+      return NULL;
+    }
+
+    // Uniformly quantize to 32 shades of each primary and count the colors.
+    Histogram cells(c_colorCells);
+    Count_Color_Cells(data, width, height, cells);
+
+    // The 256 most popular colors make the palette, ties to the lower cell.
+    vector< pair<unsigned int, int> > popular;
+    for(int cell = 0; cell < c_colorCells; cell++){
+      if(cells.Count(cell))
+        popular.push_back(make_pair(cells.Count(cell), cell));
+    }
+
+    int colors = Min((int)popular.size(), c_paletteColors);
+    partial_sort(popular.begin(), popular.begin() + colors, popular.end(),
+                 [](const pair<unsigned int, int>& a, const pair<unsigned int, int>& b)
+                 { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+
+    vector<unsigned char> palette(colors * 3);
+    for(int i = 0; i < colors; i++)
+      Cell_Color(popular[i].second, &palette[i * 3]);
+
+    Map_To_Palette(data, width, height, palette);
+
+    return true;
 }// Quant_Populosity
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to an 8 bit image using median cut quantization.
+//  The distinct colors, cut to 32 shades of each primary, are split into
+//  boxes until there are 256: the heaviest box that still holds two colors
+//  is cut across its longest side at the median pixel.  Each box becomes
+//  the weighted mean of its colors.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Median()
+{
+    if(!data){
+      return NULL;
+    }
+
+    // The color list holds each 5-5-5 cell in use once, with its pixel
+    // count, so its size stays bounded however many colors the image has.
+    Histogram cells(c_colorCells);
+    Count_Color_Cells(data, width, height, cells);
+
+    vector<WeightedColor> colors;
+    for(int cell = 0; cell < c_colorCells; cell++){
+      if(cells.Count(cell)){
+        WeightedColor color;
+        Cell_Color(cell, color.rgb);
+        color.weight = cells.Count(cell);
+        colors.push_back(color);
+      }
+    }
+
+    vector<ColorBox> boxes(1);
+    boxes[0].begin = 0;
+    boxes[0].end = (int)colors.size();
+    Fit_Box(colors, boxes[0]);
+
+    while((int)boxes.size() < c_paletteColors){
+      int heaviest = -1;
+      for(int i = 0; i < (int)boxes.size(); i++){
+        if(boxes[i].end - boxes[i].begin > 1 && (heaviest < 0 || boxes[i].weight > boxes[heaviest].weight))
+          heaviest = i;
+      }
+      if(heaviest < 0)
+        break;
+
+      ColorBox& box = boxes[heaviest];
+      int axis = 0;
+      for(int c = 1; c < 3; c++){
+        if(box.high[c] - box.low[c] > box.high[axis] - box.low[axis])
+          axis = c;
+      }
+
+      ColorBox upper = box;
+      upper.begin = Split_At_Weighted_Median(colors, box.begin, box.end, axis, box.weight);
+      box.end = upper.begin;
+      Fit_Box(colors, box);
+      Fit_Box(colors, upper);
+      boxes.push_back(upper);
+    }
+
+    vector<unsigned char> palette(boxes.size() * 3);
+    for(size_t i = 0; i < boxes.size(); i++){
+      double sum[3] = { 0, 0, 0 };
+      for(int j = boxes[i].begin; j < boxes[i].end; j++){
+        for(int c = 0; c < 3; c++)
+          sum[c] += (double)colors[j].rgb[c] * colors[j].weight;
+      }
+      for(int c = 0; c < 3; c++)
+        palette[i * 3 + c] = (unsigned char)(sum[c] / boxes[i].weight + 0.5);
+    }
+
+    Map_To_Palette(data, width, height, palette);
+
+    return true;
+}// Quant_Median
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to at most colors colors with an octree built in
+//  one pass over the rows.  depth, from 1 to 8, is how many bits of each
+//  primary the tree tells apart; lower is faster and coarser.  Each pixel
+//  becomes the mean of the colors that share its leaf.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Octree(unsigned int colors, unsigned int depth)
+{
+    if(!data){
+      return NULL;
+    }
+
+    const PixelKernels& kernels = Pixel_Kernels();
+    ColorOctree         tree(colors, depth);
+    vector<unsigned char> rgb(width * 3);
+
+    for(int y = 0; y < height; y++){
+      kernels.Unpremultiply_Row(data + y * width * 4, &rgb[0], width);
+      tree.Add_Row(&rgb[0], width);
+    }
+
+    vector<unsigned char> palette;
+    tree.Build_Palette(palette);
+
+    // The tree is only read from here on, so the bands can share it.
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        vector<unsigned char> rgb(width * 3);
+
+        for (int y = y_begin; y < y_end; y++)
+        {
+            unsigned char* row = data + y * width * 4;
+            kernels.Unpremultiply_Row(row, &rgb[0], width);
+
+            int index = 0;              // runs of one color walk the tree once
+            for (int x = 0; x < width; x++)
+            {
+                if (x == 0 || memcmp(&rgb[x * 3], &rgb[x * 3 - 3], 3))
+                    index = tree.Index_Of(&rgb[x * 3]);
+
+                const unsigned char* color = &palette[index * 3];
+                row[x * 4] = color[0];
+                row[x * 4 + 1] = color[1];
+                row[x * 4 + 2] = color[2];
+            }
+        }
+    });
+
+    return true;
+}// Quant_Octree
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Dither the image using a threshold of 1/2.  Return success of operation.
@@ -308,32 +606,14 @@ bool TargaImage::Dither_Threshold()
     To_Grayscale();
 
     // since all pixels are now teh same grayscale value, we only need to look at the first Red pixel. 
-    // we are going to be lazy and convert the pixel value from 0-255 to [0-1.0) in place.
+    // A threshold of 0.5 on [0-1.0) is red/256 >= 0.5, which is just red >= 128.
+    const PixelKernels& kernels = Pixel_Kernels();
 
-    float threshold = 0.5;
-    unsigned char white = 255;
-    unsigned char black = 0;
-
-    for(int i = 0; i < width * height * 4; i += 4){
-      unsigned char rgb[3];
-      float fractional_pixel;
-
-      RGBA_To_RGB(data + i, rgb);
-      // Convert pixel data to between [0-1.0)
-
-      fractional_pixel = (rgb[0]/(float)256);
-      if(fractional_pixel < threshold){
-        data[i] = black;
-        data[i+1] = black;
-        data[i+2] = black;
-      }
-      else{
-        // above the threshold
-        data[i] = white;
-        data[i+1] = white;
-        data[i+2] = white;
-      }
-    }
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        for(int y = y_begin; y < y_end; y++)
+          kernels.Threshold_Row(data + y * width * 4, width);
+    });
 
     return true;
 }// Dither_Threshold
@@ -341,62 +621,51 @@ bool TargaImage::Dither_Threshold()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Dither image using random dithering.  Return success of operation.
+//      Dither image using random dithering.  The noise of each pixel is a
+//  hash of the seed and the pixel's position, so the same seed gives the
+//  same image on any number of threads.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Random()
+bool TargaImage::Dither_Random(unsigned int seed)
 {
     //From website: Use either a threshold of 0.5 or the brightness preserving threshold - your choice.
     // Therefore the easiest to do is 0.5 threshold!!!!
 
-    // seed random number generator with current time
-    srand(time(NULL));
-
     if(!data){
       return NULL;
     }
     // Convert to Grayscale
     To_Grayscale();
 
-    // since all pixels are now teh same grayscale value, we only need to look at the first Red pixel. 
-    // we are going to be lazy and convert the pixel value from 0-255 to [0-1.0) in place.
-
-    float threshold = 0.5;
     unsigned char white = 255;
     unsigned char black = 0;
 
-    //Add random values chosen uniformly from the range [-0.2,0.2]
+    // Add random values chosen uniformly from the range [-0.2,0.2) to value/256
+    // and threshold at 0.5.  The top 16 bits of the hash are the noise in
+    // steps of 0.4/65536, so in integers that is value * 640 + noise >= (0.5 + 0.2) * 256 * 640.
+    const int           c_noiseScale = 640;
+    const int           c_threshold = 114688;
+    const PixelKernels& kernels = Pixel_Kernels();
 
-    for(int i = 0; i < width * height * 4; i += 4){
-      unsigned char rgb[3];
-      float fractional_pixel;
-
-      RGBA_To_RGB(data + i, rgb);
-      // Convert pixel data to between [0-1.0)
-
-      // get random number in range
-      float max = 0.2;
-      float min = -0.2;
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        vector<unsigned char> rgb(width * 3);
 
-      // c++ for not having good ways to generate randoms
-      // float r3 = LO + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(HI-LO)));
+        for(int y = y_begin; y < y_end; y++){
+          unsigned char* row = data + y * width * 4;
+          unsigned int row_key = Hash_32(seed ^ Hash_32(y));
 
-      float notreallyrandom = min + static_cast <float> (rand())/(static_cast <float> (RAND_MAX/(max-min)));
-      //float notreallyrandom = rand() % (max-min + 1) + min;
+          kernels.Unpremultiply_Row(row, &rgb[0], width);
 
-      fractional_pixel = (rgb[0]/(float)256) + notreallyrandom;
-      if(fractional_pixel < threshold){
-        data[i] = black;
-        data[i+1] = black;
-        data[i+2] = black;
-      }
-      else{
-        // above the threshold
-        data[i] = white;
-        data[i+1] = white;
-        data[i+2] = white;
-      }
-    }
+          for(int x = 0; x < width; x++){
+            int noise = Hash_32(row_key + x) >> 16;
+            unsigned char value = rgb[x * 3] * c_noiseScale + noise >= c_threshold ? white : black;
+            row[x * 4] = value;
+            row[x * 4 + 1] = value;
+            row[x * 4 + 2] = value;
+          }
+        }
+    });
 
     return true;
 }// Dither_Random
@@ -408,13 +677,86 @@ bool TargaImage::Dither_Random()
 //  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_FS()
+bool TargaImage::Dither_FS(bool serpentine)
 {
-    ClearToBlack();
-    return false;
+    if(!data){
+      return NULL;
+    }
+    To_Grayscale();
+    Diffuse_Errors<FloydSteinberg, GrayLevels>(data, width, height, serpentine);
+    return true;
 }// Dither_FS
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Error diffusion dithering with the Jarvis, Judice and Ninke matrix,
+//  which spreads each error over the next two rows.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Jarvis(bool serpentine)
+{
+    if(!data){
+      return NULL;
+    }
+    To_Grayscale();
+    Diffuse_Errors<JarvisJudiceNinke, GrayLevels>(data, width, height, serpentine);
+    return true;
+}// Dither_Jarvis
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Error diffusion dithering with the Stucki matrix, a sharper Jarvis.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Stucki(bool serpentine)
+{
+    if(!data){
+      return NULL;
+    }
+    To_Grayscale();
+    Diffuse_Errors<Stucki, GrayLevels>(data, width, height, serpentine);
+    return true;
+}// Dither_Stucki
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Error diffusion dithering with the Burkes matrix, Stucki cut to one
+//  row below.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Burkes(bool serpentine)
+{
+    if(!data){
+      return NULL;
+    }
+    To_Grayscale();
+    Diffuse_Errors<Burkes, GrayLevels>(data, width, height, serpentine);
+    return true;
+}// Dither_Burkes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Error diffusion dithering with the Atkinson matrix, which passes on
+//  only three quarters of each error.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Atkinson(bool serpentine)
+{
+    if(!data){
+      return NULL;
+    }
+    To_Grayscale();
+    Diffuse_Errors<Atkinson, GrayLevels>(data, width, height, serpentine);
+    return true;
+}// Dither_Atkinson
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Dither the image while conserving the average brightness.  Return 
@@ -426,50 +768,52 @@ bool TargaImage::Dither_Bright()
     if(!data){
       return NULL;
     }
-    // Convert to Grayscale
-    To_Grayscale();
-
     unsigned char white = 255;
     unsigned char black = 0;
-    double sum = 0;
 
-    //c++ arrays why can't you be more like python?
-    //guess we're going to use a vector becuase that's easiest
-    vector<unsigned char> image_vector;
+    // Convert to Grayscale and count the gray levels in the same pass
+    const PixelKernels& kernels = Pixel_Kernels();
+    Histogram levels;
 
-    for(int i = 0; i < width * height * 4; i += 4){
-      unsigned char rgb[3];
-      RGBA_To_RGB(data + i, rgb);
-      sum += rgb[0];
-      image_vector.push_back(rgb[0]);
-    }
+    levels.Build(height, [&](int y_begin, int y_end, unsigned int* bins)
+    {
+        vector<unsigned char> rgb(width * 3);
+
+        for(int y = y_begin; y < y_end; y++){
+          unsigned char* row = data + y * width * 4;
+          kernels.Gray_Row(row, width);
+          kernels.Unpremultiply_Row(row, &rgb[0], width);
+          for(int x = 0; x < width; x++)
+            bins[rgb[x * 3]]++;
+        }
+    });
 
     // Compute average brightness
+    double sum = levels.Sum();
     float average_percent = sum/(width * height)/(float)255.0;
     // between 0 and 1.0
     float threshold_index = (1 - average_percent)*(width * height);
 
-    // now we need to get the value of the pixel at the threshold_index
-    // we need an array of sorted values of all the pixels in the image
-    sort(image_vector.begin(), image_vector.end()); 
-    unsigned char threshold_pixel_value = image_vector[threshold_index];
+    // the pixel at threshold_index in sorted order, an all black image
+    // puts it one past the end and gets the last pixel
+    unsigned char threshold_pixel_value = (unsigned char)levels.Bin_Of_Rank((unsigned int)threshold_index);
 
-    for(int i = 0; i < width * height * 4; i += 4){
-      unsigned char rgb[3];
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        vector<unsigned char> rgb(width * 3);
 
-      RGBA_To_RGB(data + i, rgb);
-      if(rgb[0] < threshold_pixel_value){
-        data[i] = black;
-        data[i+1] = black;
-        data[i+2] = black;
-      }
-      else{
-        data[i] = white;
-        data[i+1] = white;
-        data[i+2] = white;
-      }
+        for(int y = y_begin; y < y_end; y++){
+          unsigned char* row = data + y * width * 4;
+          kernels.Unpremultiply_Row(row, &rgb[0], width);
 
-    }
+          for(int x = 0; x < width; x++){
+            unsigned char value = rgb[x * 3] < threshold_pixel_value ? black : white;
+            row[x * 4] = value;
+            row[x * 4 + 1] = value;
+            row[x * 4 + 2] = value;
+          }
+        }
+    });
     return true;
 }// Dither_Bright
 
@@ -481,46 +825,29 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
+    return Dither_Pattern(ThresholdMatrix::Cluster());
+}// Dither_Cluster
 
-   // Dither an image to black and white using cluster dithering with the matrix shown below. The image pixels should be compared to a threshold that depends on the dither matrix below. The pixel should be drawn white if: I[x][y] >= mask[x%4][y%4]. The matrix is:
 
-   float threshold_matrix[4][4] = {{.75,    .375,   .625,   .25},
-                             {.0625,     1,   .875, .4375},
-                             {.5,    .8125,  .9375, .1250},
-                             {.1875, .5625,  .3125, .6875}}; 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image to black and white with any threshold matrix.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Pattern(const ThresholdMatrix& matrix)
+{
     if(!data){
       return NULL;
     }
     // Convert to Grayscale
     To_Grayscale();
 
-    unsigned char white = 255;
-    unsigned char black = 0;
-    for(int i = 0; i < height; i++){
-      for(int j = 0; j < width; j++){
-        int offset = ((i*width) + j) * 4;
-        unsigned char rgb[3];
-
-        RGBA_To_RGB(data + offset, rgb);
-        float fractional_pixel = (rgb[0]/(float)256);
-
-        if(fractional_pixel >= threshold_matrix[i%4][j%4]){
-          data[offset] = white;
-          data[offset+1] = white;
-          data[offset+2] = white;
-          data[offset+3] = 255; // alpha stays the same, all opaque
-        }
-        else{
-          data[offset] = black;
-          data[offset+1] = black;
-          data[offset+2] = black;
-          data[offset+3] = 255; //alpha stays the same, all opaque
-        }
-      }
-    }
+    // alpha becomes 255, all opaque
+    matrix.Dither(data, width, height);
 
     return true;
-}// Dither_Cluster
+}// Dither_Pattern
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -532,11 +859,33 @@ bool TargaImage::Dither_Cluster()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Color()
 {
-    ClearToBlack();
-    return false;
+    if(!data){
+      return NULL;
+    }
+    Diffuse_Errors<FloydSteinberg, UniformLevels>(data, width, height, false);
+    return true;
 }// Dither_Color
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite the premultiplied pixels of f with those of g, in place,
+//  by a Porter-Duff operator.  Rows are contiguous, so each band of rows
+//  is one kernel call.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Composite_Rows(unsigned char* f, const unsigned char* g, int width, int height, EPorterDuff op)
+{
+    const PixelKernels& kernels = Pixel_Kernels();
+
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        unsigned char* rows = f + y_begin * width * 4;
+        kernels.Composite_Row[op](rows, g + y_begin * width * 4, rows, (y_end - y_begin) * width);
+    });
+}// Composite_Rows
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Composite the current image over the given image.  Return success of 
@@ -551,16 +900,8 @@ bool TargaImage::Comp_Over(TargaImage* pImage)
         return false;
     }
 
-    // loop over base image
-    for(int i = 0; i < width * height * 4; i += 4){
-      // convert alpha to [0-1.0)
-      double alpha = ((double)data[i+3]/255.0);
-      for(int channel = 0; channel < 4; channel++){
-        // overlay current image over the given image with the correct alpha value
-        //c = Fc + Gc = c + (1−α )c
-        data[i + channel] = data[i + channel] + (pImage -> data[i + channel] * (1.0 - alpha));
-      }
-    }
+    // F + (1 - alpha_f) G
+    Composite_Rows(data, pImage->data, width, height, COMPOSITE_OVER);
 
     return true;
 }// Comp_Over
@@ -580,16 +921,8 @@ bool TargaImage::Comp_In(TargaImage* pImage)
         return false;
     }
 
-    // loop over base image
-    for(int i = 0; i < width * height * 4; i += 4){
-      // convert alpha to [0-1.0)
-      double alpha = ((double)pImage -> data[i+3]/255.0);
-      for(int channel = 0; channel < 4; channel++){
-        // overlay current image over the given image with the correct alpha value
-        //c = Fc + Gc =α c
-        data[i + channel] = data[i + channel] * alpha;
-      }
-    }
+    // alpha_g F
+    Composite_Rows(data, pImage->data, width, height, COMPOSITE_IN);
 
     return true;
 }// Comp_In
@@ -608,16 +941,8 @@ bool TargaImage::Comp_Out(TargaImage* pImage)
         cout << "Comp_Out: Images not the same size\n";
         return false;
     }
-    // loop over base image
-    for(int i = 0; i < width * height * 4; i += 4){
-      // convert alpha to [0-1.0)
-      double alpha = ((double)pImage -> data[i+3]/255.0);
-      for(int channel = 0; channel < 4; channel++){
-        // overlay current image over the given image with the correct alpha value
-        //c = Fc + Gc =(1-α) c
-        data[i + channel] = data[i + channel] * (1.0 - alpha);
-      }
-    }
+    // (1 - alpha_g) F
+    Composite_Rows(data, pImage->data, width, height, COMPOSITE_OUT);
 
     return true;
 }// Comp_Out
@@ -636,16 +961,8 @@ bool TargaImage::Comp_Atop(TargaImage* pImage)
         cout << "Comp_Atop: Images not the same size\n";
         return false;
     }
-    // loop over base image
-    for(int i = 0; i < width * height * 4; i += 4){
-      // convert alpha to [0-1.0)
-      double alpha_f = ((double)data[i+3]/255.0);
-      double alpha_g = ((double)pImage -> data[i+3]/255.0);
-      for(int channel = 0; channel < 4; channel++){
-        // overlay current image over the given image with the correct alpha value
-        data[i + channel] = (data[i + channel] * alpha_g) + (pImage -> data[i + channel] * (1.0 - alpha_f));
-      }
-    }
+    // alpha_g F + (1 - alpha_f) G
+    Composite_Rows(data, pImage->data, width, height, COMPOSITE_ATOP);
 
     return true;
 }// Comp_Atop
@@ -665,21 +982,80 @@ bool TargaImage::Comp_Xor(TargaImage* pImage)
         return false;
     }
 
-    // loop over base image
-    for(int i = 0; i < width * height * 4; i += 4){
-      // convert alpha to [0-1.0)
-      double alpha_f = ((double)data[i+3]/255.0);
-      double alpha_g = ((double)pImage -> data[i+3]/255.0);
-      for(int channel = 0; channel < 4; channel++){
-        // overlay current image over the given image with the correct alpha value
-        data[i + channel] = (data[i + channel] * (1.0 - alpha_g)) + (pImage -> data[i + channel] * (1.0 - alpha_f));
-      }
-    }
+    // (1 - alpha_g) F + (1 - alpha_f) G
+    Composite_Rows(data, pImage->data, width, height, COMPOSITE_XOR);
 
     return true;
 }// Comp_Xor
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Composite a region of the given image onto this one at an offset:
+//  the source rectangle of pImage, with its top left corner at (x, y) in
+//  this image, op this image.  The source rectangle is cut to pImage and
+//  the destination to the clip rectangle and this image, and only the
+//  pixels of this image left inside all of them change, so the work goes
+//  with the size of the overlap and not of either image.  pImage may be
+//  this image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Comp_Region(TargaImage* pImage, EPorterDuff op, int x, int y,
+                             const ImageRect* pSource, const ImageRect* pClip)
+{
+    if (!data || !pImage || !pImage->data)
+        return false;
+
+    ImageRect source = { 0, 0, pImage->width, pImage->height };
+    ImageRect clip = { 0, 0, width, height };
+    if (pSource)
+        source = *pSource;
+    if (pClip)
+        clip = *pClip;
+
+    // overlap in this image, as [left, right) by [top, bottom)
+    int left    = Max(Max(x, x - source.x), Max(clip.x, 0));
+    int top     = Max(Max(y, y - source.y), Max(clip.y, 0));
+    int right   = Min(Min(x + source.width, x - source.x + pImage->width), Min(clip.x + clip.width, width));
+    int bottom  = Min(Min(y + source.height, y - source.y + pImage->height), Min(clip.y + clip.height, height));
+
+    if (left >= right || top >= bottom)
+        return true;
+
+    // where the overlap starts in pImage
+    int source_x = source.x + left - x;
+    int source_y = source.y + top - y;
+
+    const unsigned char* from = pImage->data + (source_y * pImage->width + source_x) * 4;
+    int from_stride = pImage->width * 4;
+
+    // onto itself the source and destination rectangles can overlap, and
+    // rows would be read after other rows already wrote over them, so the
+    // source rectangle is copied first
+    vector<unsigned char> copy;
+    if (pImage == this)
+    {
+        copy.resize((bottom - top) * (right - left) * 4);
+        for (int r = 0; r < bottom - top; ++r)
+            memcpy(&copy[r * (right - left) * 4], from + r * from_stride, (right - left) * 4);
+        from = &copy[0];
+        from_stride = (right - left) * 4;
+    }
+
+    const PixelKernels& kernels = Pixel_Kernels();
+    Parallel_For_Rows(bottom - top, [&](int r_begin, int r_end)
+    {
+        for (int r = r_begin; r < r_end; ++r)
+        {
+            unsigned char* row = data + ((top + r) * width + left) * 4;
+            kernels.Composite_Row[op](from + r * from_stride, row, row, right - left);
+        }
+    });
+
+    return true;
+}// Comp_Region
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Calculate the difference bewteen this imag and the given one.  Image 
@@ -697,89 +1073,117 @@ bool TargaImage::Difference(TargaImage* pImage)
         return false;
     }// if
 
-    for (int i = 0 ; i < width * height * 4 ; i += 4)
-    {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
+    const PixelKernels& kernels = Pixel_Kernels();
 
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        vector<unsigned char> other(width * 4);
 
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i+1] = abs(rgb1[1] - rgb2[1]);
-        data[i+2] = abs(rgb1[2] - rgb2[2]);
-        data[i+3] = 255;
-    }
+        for (int y = y_begin ; y < y_end ; ++y)
+        {
+            unsigned char* row = data + y * width * 4;
+
+            // both rows to straight color first, this one in place
+            kernels.Straighten_Row(row, row, width);
+            kernels.Straighten_Row(pImage->data + y * width * 4, &other[0], width);
+
+            for (int i = 0 ; i < width * 4 ; i += 4)
+            {
+                row[i] = abs(row[i] - other[i]);
+                row[i+1] = abs(row[i+1] - other[i+1]);
+                row[i+2] = abs(row[i+2] - other[i+2]);
+                row[i+3] = 255;
+            }
+        }
+    });
 
     return true;
 }// Difference
 
 
-bool TargaImage::Apply_Filter_To_Image(double filter[5][5]){
-  // Oh man this was a nightmare to figure out. 
-  // I ended up writing pseudo code on paper, them implementing this and hoping it actually worked.
-  // 5 nested for loops feels like inception at times.
-  // There is some error correcting codes for edge detection, but they are pretty basic. 
-  // this is a basic algorithm that has some (mostly edge detection) has been adopted from a few online algorithms (forget source)
-  
-  // convert our source image to a rgb array without alpha.
-  unsigned char * rgb = To_RGB();
-  // Look through the image from left to right, wrapping on new rows
-  for(int x = 0; x < height; ++x){
-    for(int y = 0; y < width; ++y){
-      // we have to apply the filter matrix for each RGB color, so we do this 0,1,2 times. 
-      for(int color = 0; color < 3; ++color){
-        // since we are averaging, we need to compute the sum of all the filter applications within the matrix
-        // we do not need to worry about dividing by a value since the filter has that factored in (say 1/81 for bartlett for example)
-        double sum = 0;
-        for(int row = 0; row < 5; ++row){
-          for(int column = 0; column < 5; ++column){
-            // loop through all the rows and columns of the filter matrix
-            //start with upper left corner of matrix
-            int row_position = x - 2 + row;
-            //start with upper left corner of matrix
-            int column_position = y - 2 + column;
-
-            // edge detection and correction
-            if(row_position < 0){
-              // if the row position is negative (outside image), reflect about the same axis (same as instructions on project website i think?)
-              row_position = -row_position;
-            }
-            if(row_position >= height){
-              // if we go past to the bottom of the image outside
-              // adjust to be in the image again
-              row_position = ((height * 2) - 2) - row_position;
-            }
-            if(column_position < 0){
-              // if the column position is negative (outside image), reflect about the same axis (same as instructions on project website i think?)
-              column_position = -column_position;
-            }
-            if(column_position >= width){
-              // if we go past the width of the image
-              // adjust to be in the image again
-              column_position = ((width * 2) - 2) - column_position;
-            }
-            // Add the current rgb position pixel * the filter to get the value for that filter element
-            // adjusts for RGB offset with the *3 and adds color to get the correct color for the color we are on in our loop
-            sum += rgb[((row_position * width + column_position) * 3) + color] * filter[row][column];
-          }
-        }
-        // assign the output image pixel the sum we just computed with our filter.
-        data[(x * width + y) * 4 + color] = sum;
-        // clamping
-        if(sum > 255) {
-          data[(x * width + y) * 4 + color] = 255;          
-        }
-        else if(sum < 0){
-          data[(x * width + y) * 4 + color] = 0;
-        }
-      }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Measure how far this image is from the given one, by their straight
+//  color, without changing either.  Image dimensions must be equal.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Metrics(TargaImage* pImage, ImageMetrics& metrics)
+{
+    if (!pImage || !data || !pImage->data)
+        return false;
+
+    if (width != pImage->width || height != pImage->height)
+    {
+        cout << "Metrics: Images not the same size\n";
+        return false;
+    }// if
+
+    metrics = Measure_Images(data, pImage->data, width, height);
+    return true;
+}// Metrics
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Apply a 5x5 filter to the RGB channels of this image, reflecting about
+//  the borders.  Alpha is left unchanged.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Apply_Filter_To_Image(double filter[5][5])
+{
+    return Apply_Filter_To_Image(&filter[0][0], 5);
+}// Apply_Filter_To_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Apply a size x size filter (row major, size odd) to the RGB channels of
+//  this image.  The weights become integer taps over a common divisor and
+//  separable kernels run as a row pass and a column pass; see Convolution.h.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Apply_Filter_To_Image(const double* filter, int size)
+{
+    if (!data || size < 1 || size % 2 != 1)
+        return false;
+
+    return Apply_Kernel_To_Image(ConvolutionKernel(size, filter));
+}// Apply_Filter_To_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Apply a prepared kernel to the RGB channels of this image.  Kernels
+//  that cost at least c_minFftTaps multiplies per pixel in space (9x9 and up,
+//  or 29 wide and up if separable) go through the FFT, which gives the same
+//  result.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Apply_Kernel_To_Image(const ConvolutionKernel& kernel)
+{
+    // every band reads its halo rows from the copy
+    unsigned char* source = Straight_Copy();
+
+    if (kernel.Taps_Per_Pixel() >= c_minFftTaps)
+    {
+        Parallel_For_Rows(height, [&](int y_begin, int y_end)
+        {
+            Fft_Convolve_Rows(kernel, source, data, width, height, y_begin, y_end);
+        }, Fft_Tile_Rows(kernel));
     }
-  }
-  // To_RGB says we should clean up after ourselves...
-  delete[] rgb;
-  return true;
-}
+    else
+    {
+        Parallel_For_Rows(height, [&](int y_begin, int y_end)
+        {
+            Convolve_Rows(kernel, source, data, width, height, y_begin, y_end);
+        });
+    }
+
+    delete[] source;
+    return true;
+}// Apply_Kernel_To_Image
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -800,6 +1204,32 @@ bool TargaImage::Filter_Box()
 }// Filter_Box
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a (2 * radius + 1) square box filter on this image, reflecting
+//  about the borders like the 5x5 filters.  Running sums keep the cost per
+//  pixel the same for any radius.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_N(unsigned int radius)
+{
+    if (!data || radius > (unsigned int)c_maxBoxRadius)
+        return false;
+
+    unsigned char* source = Straight_Copy();
+
+    // each band starts by summing a whole window of rows, so keep bands at
+    // least as tall as the radius and that start up stays a fraction of the work
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
+    {
+        Box_Blur_Rows(radius, source, data, width, height, y_begin, y_end);
+    }, Max(8, (int)radius));
+
+    delete[] source;
+    return true;
+}// Filter_Box_N
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Perform 5x5 Bartlett filter on this image.  Return success of 
@@ -836,17 +1266,42 @@ bool TargaImage::Filter_Gaussian()
     return true;
 }// Filter_Gaussian
 
+
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
-//  operation.
+//      Perform NxN Gaussian filter on this image.  Up to c_maxExactGaussian
+//  this is the exact binomial kernel, which costs 2N multiplies per channel
+//  and is no slower than the recursive filter there.  Past that Deriche's
+//  recursive Gaussian with the same variance, (N-1)/4, takes over and the
+//  cost no longer grows with N.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-
 bool TargaImage::Filter_Gaussian_N( unsigned int N )
 {
-    ClearToBlack();
-   return false;
+    if (!data || N % 2 != 1)
+        return false;
+
+    if (N <= c_maxExactGaussian)
+    {
+        vector<int> factor(N);
+        for (unsigned int i = 0; i < N; i++)
+            factor[i] = (int)Binomial(N - 1, i);
+
+        return Apply_Kernel_To_Image(ConvolutionKernel(factor, 1 << (2 * (N - 1))));
+    }
+
+    double sigma = sqrt((double)(N - 1)) / 2;
+    unsigned char* source = Straight_Copy();
+
+    // bands of whole chunks, so no chunk is filtered by two threads
+    int chunk_rows = Recursive_Gaussian_Chunk(sigma, height);
+    Parallel_For_Rows((height + chunk_rows - 1) / chunk_rows, [&](int c_begin, int c_end)
+    {
+        Recursive_Gaussian_Rows(sigma, source, data, width, height, c_begin * chunk_rows, Min(c_end * chunk_rows, height));
+    }, 1);
+
+    delete[] source;
+    return true;
 }// Filter_Gaussian_N
 
 
@@ -921,58 +1376,55 @@ bool TargaImage::Half_Size()
                            {1.0/16.0, 1.0/8.0, 1.0/16.0}};
 
     unsigned char * rgb = To_RGB();
+    if (!rgb)
+      return false;
 
-    unsigned char * new_image = new unsigned char[width * height];
-    for(int x = 0; x < height; x += 2){
-      for(int y = 0; y < width; y += 2){
-        for(int color = 0; color < 3; color++){
-          // loop through each rgb color.
-          //apply filter to adjacent pixels.
-          double sum = 0;
-          for(int row = 0; row < 3; row++){
-            for(int column = 0; column < 3; column++){
-              int row_position = x - 1 + row;
-              int column_position = y - 1 + column;
-              if(row_position < 0){
-                row_position = -row_position;
-              }
-              if(row_position >= height){
-                row_position = ((height * 2) - 1) - row_position;
-              }
-              if(column_position < 0){
-                column_position = -column_position;
-              }
-              if(column_position >= width){
-                column_position = ((width * 2) - 1) - column_position;
+    int new_width = width / 2;
+    int new_height = height / 2;
+    unsigned char * new_image = new unsigned char[new_width * new_height * 4];
+
+    // each band writes its own output rows, the 3x3 window reads rgb so
+    // there is nothing to share between bands
+    Parallel_For_Rows(new_height, [&](int y_begin, int y_end)
+    {
+      for(int x = y_begin * 2; x < y_end * 2; x += 2){
+        for(int y = 0; y < new_width * 2; y += 2){
+          for(int color = 0; color < 3; color++){
+            // loop through each rgb color.
+            //apply filter to adjacent pixels.
+            double sum = 0;
+            for(int row = 0; row < 3; row++){
+              for(int column = 0; column < 3; column++){
+                int row_position = x - 1 + row;
+                int column_position = y - 1 + column;
+                if(row_position < 0){
+                  row_position = -row_position;
+                }
+                if(row_position >= height){
+                  row_position = ((height * 2) - 1) - row_position;
+                }
+                if(column_position < 0){
+                  column_position = -column_position;
+                }
+                if(column_position >= width){
+                  column_position = ((width * 2) - 1) - column_position;
+                }
+                sum += rgb[(row_position * width + column_position) * 3 + color] * filter[row][column];
               }
-              sum += rgb[(row_position * width + column_position) * 3 + color] * filter[row][column];
             }
+            // apply the filter sum to the new image
+            new_image[(x/2 * new_width + y/2) * 4 + color] = sum;
           }
-          //data[(x/2 * (width) + y/2) * 4 + color] = data[(x * (width) + y) * 4 + color];
-          // apply the filter sum to the new image
-          //cout << x+y << endl;
-          // 212
-          // 610 
-          // 214
-          new_image[(x/2 * (width/2) + y/2) * 4 + color] = sum;
+          //alpha
+          new_image[(x/2 * new_width + y/2) * 4 + 3] = 255;
         }
-        //alpha
-        new_image[(x/2 * (width/2) + y/2) * 4 + 4 ] = 255;
       }
-    }
-    //data = new_image;
+    });
 
     delete[] data;
-    data = new unsigned char[width * height];
-    for(int i = 0; i < (width * height); i++){
-      // copy image pixels
-      data[i] = new_image[i];
-    }
-    height = height / 2;
-    width = width / 2;
-    // resize image to cut off half of the pixels.
-    //width = width / 2;
-    //height = height / 2;
+    data = new_image;
+    width = new_width;
+    height = new_height;
     delete[] rgb;
 
     return true;
@@ -1025,69 +1477,31 @@ bool TargaImage::Rotate(float angleDegrees)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
 {
-    const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
-
-    unsigned char  alpha = rgba[3];
-
-    if (alpha == 0)
-    {
-        rgb[0] = BACKGROUND[0];
-        rgb[1] = BACKGROUND[1];
-        rgb[2] = BACKGROUND[2];
-    }
-    else
-    {
-	    float	alpha_scale = (float)255 / (float)alpha;
-	    int	val;
-	    int	i;
-
-	    for (i = 0 ; i < 3 ; i++)
-	    {
-	        val = (int)floor(rgba[i] * alpha_scale);
-	        if (val < 0)
-		    rgb[i] = 0;
-	        else if (val > 255)
-		    rgb[i] = 255;
-	        else
-		    rgb[i] = val;
-	    }
-    }
+    Unpremultiply_Pixel(rgba, rgb);
 }// RGA_To_RGB
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy this into a new image, reversing the rows as it goes. A pointer
-//  to the new image is returned.
+//      Return a new width x height RGBA buffer holding the straight (not
+//  premultiplied) color of this image, with the alpha kept alongside so its
+//  rows line up with data.  The filters read from it while writing data.
+//  The caller deletes it.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage* TargaImage::Reverse_Rows(void)
+unsigned char* TargaImage::Straight_Copy()
 {
-    unsigned char   *dest = new unsigned char[width * height * 4];
-    TargaImage	    *result;
-    int 	        i, j;
-
-    if (! data)
-    	return NULL;
+    unsigned char*      source = new unsigned char[width * height * 4];
+    const PixelKernels& kernels = Pixel_Kernels();
 
-    for (i = 0 ; i < height ; i++)
+    Parallel_For_Rows(height, [&](int y_begin, int y_end)
     {
-	    int in_offset = (height - i - 1) * width * 4;
-	    int out_offset = i * width * 4;
+        int offset = y_begin * width * 4;
+        kernels.Straighten_Row(data + offset, source + offset, (y_end - y_begin) * width);
+    });
 
-	    for (j = 0 ; j < width ; j++)
-        {
-	        dest[out_offset + j * 4] = data[in_offset + j * 4];
-	        dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-	        dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-	        dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
-        }
-    }
-
-    result = new TargaImage(width, height, dest);
-    delete[] dest;
-    return result;
-}// Reverse_Rows
+    return source;
+}// Straight_Copy
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -15,9 +15,18 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
+#include "PixelKernels.h"
 
 class Stroke;
 class DistanceImage;
+class ConvolutionKernel;
+class ThresholdMatrix;
+struct ImageMetrics;
+
+struct ImageRect        // width by height pixels from column x, row y down from the top
+{
+    int x, y, width, height;
+};
 
 class TargaImage
 {
@@ -38,12 +47,18 @@ class TargaImage
         bool Quant_Uniform();
         bool Quant_Populosity();
         bool Quant_Median();
+        bool Quant_Octree(unsigned int colors, unsigned int depth);
 
         bool Dither_Threshold();
-        bool Dither_Random();
-        bool Dither_FS();
+        bool Dither_Random(unsigned int seed = 0);
+        bool Dither_FS(bool serpentine = false);
+        bool Dither_Jarvis(bool serpentine = false);
+        bool Dither_Stucki(bool serpentine = false);
+        bool Dither_Burkes(bool serpentine = false);
+        bool Dither_Atkinson(bool serpentine = false);
         bool Dither_Bright();
         bool Dither_Cluster();
+        bool Dither_Pattern(const ThresholdMatrix& matrix);
         bool Dither_Color();
 
         bool Comp_Over(TargaImage* pImage);
@@ -51,10 +66,17 @@ class TargaImage
         bool Comp_Out(TargaImage* pImage);
         bool Comp_Atop(TargaImage* pImage);
         bool Comp_Xor(TargaImage* pImage);
+        // pImage, its source rectangle's corner placed at (x, y), op this
+        // image; only the overlap inside clip is touched, NULL meaning the
+        // whole image
+        bool Comp_Region(TargaImage* pImage, EPorterDuff op, int x, int y,
+                         const ImageRect* pSource = NULL, const ImageRect* pClip = NULL);
 
         bool Difference(TargaImage* pImage);
+        bool Metrics(TargaImage* pImage, ImageMetrics& metrics);
 
         bool Filter_Box();
+        bool Filter_Box_N(unsigned int radius);
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
@@ -70,13 +92,17 @@ class TargaImage
 
         // My functions
         bool Apply_Filter_To_Image(double filter[5][5]);
+        bool Apply_Filter_To_Image(const double* filter, int size);
 
     private:
 	// helper function for format conversion
         void RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb);
 
-        // reverse the rows of the image, some targas are stored bottom to top
-	TargaImage* Reverse_Rows(void);
+        // straight color copy of the image for the filters to read from
+        unsigned char* Straight_Copy();
+
+        // run a prepared kernel over the RGB channels
+        bool Apply_Kernel_To_Image(const ConvolutionKernel& kernel);
 
 	// clear image to all black
         void ClearToBlack();
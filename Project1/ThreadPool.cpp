@@ -0,0 +1,208 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp                          Author:     Benjamin Reichert
+//
+//      Implementation of the shared row-band thread pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ThreadPool.h"
+
+using namespace std;
+
+// constants
+const int       c_bandsPerThread    = 4;            // more bands than threads so uneven rows balance out
+
+// set while a thread is running a band, nested parallel loops then run inline
+static thread_local bool s_inBand = false;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the pool.  It starts with one thread per core.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool& ThreadPool::Instance()
+{
+    static ThreadPool pool;
+    return pool;
+}// Instance
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start one thread per core.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool() : m_stopping(false), m_generation(0), m_busy(0),
+                           m_band(NULL), m_rows(0), m_bandRows(0), m_nextRow(0)
+{
+    Set_Thread_Count(0);
+}// ThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Stop the workers.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::~ThreadPool()
+{
+    Stop_Workers();
+}// ~ThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set how many threads work on each job, the calling thread included.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Set_Thread_Count(int count)
+{
+    if (count <= 0)
+        count = Max((int)thread::hardware_concurrency(), 1);
+
+    lock_guard<mutex> job(m_jobMutex);
+    Stop_Workers();
+    Start_Workers(count - 1);
+}// Set_Thread_Count
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of threads working on each job, the calling thread included.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ThreadPool::Thread_Count() const
+{
+    return (int)m_workers.size() + 1;
+}// Thread_Count
+
+
+void ThreadPool::Start_Workers(int count)
+{
+    unsigned int generation;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = false;
+        generation = m_generation;
+    }
+
+    // new workers wait for the next job, not one already posted
+    for (int i = 0; i < count; ++i)
+        m_workers.push_back(thread(&ThreadPool::Worker, this, generation));
+}// Start_Workers
+
+
+void ThreadPool::Stop_Workers()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+    m_workers.clear();
+}// Stop_Workers
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take bands of the current job until none are left.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Run_Bands()
+{
+    s_inBand = true;
+    for (;;)
+    {
+        int                     y_begin, y_end;
+        const RowBandFunction*  band;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            y_begin = m_nextRow;
+            y_end = Min(y_begin + m_bandRows, m_rows);
+            band = m_band;
+            m_nextRow += m_bandRows;
+        }
+        if (y_begin >= y_end)
+            break;
+
+        (*band)(y_begin, y_end);
+    }
+    s_inBand = false;
+}// Run_Bands
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Worker thread.  Sleep until a job later than generation seen is
+//  posted, help with it, repeat.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Worker(unsigned int seen)
+{
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (!m_stopping && m_generation == seen)
+                m_wake.wait(lock);
+            if (m_stopping)
+                return;
+            seen = m_generation;
+        }
+
+        Run_Bands();
+
+        {
+            lock_guard<mutex> lock(m_mutex);
+            --m_busy;
+        }
+        m_done.notify_one();
+    }
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split [0, rows) into bands and run them on the pool.  Runs inline if
+//  there is only one thread, the image is small, or we are already inside
+//  a band.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Parallel_For_Rows(int rows, const RowBandFunction& band, int min_rows)
+{
+    if (rows <= 0)
+        return;
+
+    int threads = Thread_Count();
+    if (threads == 1 || s_inBand || rows < 2 * min_rows)
+    {
+        band(0, rows);
+        return;
+    }
+
+    lock_guard<mutex> job(m_jobMutex);
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_band = &band;
+        m_rows = rows;
+        m_bandRows = Max(min_rows, (rows + threads * c_bandsPerThread - 1) / (threads * c_bandsPerThread));
+        m_nextRow = 0;
+        m_busy = (int)m_workers.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    Run_Bands();
+
+    unique_lock<mutex> lock(m_mutex);
+    while (m_busy > 0)
+        m_done.wait(lock);
+    m_band = NULL;
+}// Parallel_For_Rows
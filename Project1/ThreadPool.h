@@ -0,0 +1,78 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h                            Author:     Benjamin Reichert
+//
+//      Shared pool of worker threads used by the TargaImage operations.  An
+//  operation hands Parallel_For_Rows the number of rows it produces and a
+//  function that processes rows [y_begin, y_end); the rows are cut into
+//  bands which the workers and the calling thread take in turn.
+//
+//  Neighborhood operations read from a separate source buffer, so each band
+//  simply reads the halo rows it needs from there.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <functional>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef std::function<void (int, int)> RowBandFunction;
+
+class ThreadPool
+{
+    // methods
+    public:
+        static ThreadPool& Instance();                      // the pool shared by every image
+
+        void    Set_Thread_Count(int count);                // 0 or less means one per core
+        int     Thread_Count() const;                       // threads working on a job, caller included
+
+        // Call band(y_begin, y_end) over [0, rows) and return once all rows are done.
+        // Bands are never shorter than min_rows so tiny images stay on one thread.
+        void    Parallel_For_Rows(int rows, const RowBandFunction& band, int min_rows = 8);
+
+    private:
+        ThreadPool();
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator =(const ThreadPool&);
+
+        void    Start_Workers(int count);
+        void    Stop_Workers();
+        void    Worker(unsigned int seen);
+        void    Run_Bands();
+
+    // members
+    private:
+        std::vector<std::thread>    m_workers;              // threads besides the caller
+        std::mutex                  m_jobMutex;             // one job at a time
+        std::mutex                  m_mutex;                // guards everything below
+        std::condition_variable     m_wake;                 // a job was posted or we are stopping
+        std::condition_variable     m_done;                 // a worker finished its share of a job
+        bool                        m_stopping;
+        unsigned int                m_generation;           // bumped for every posted job
+        int                         m_busy;                 // workers still on the current job
+
+        const RowBandFunction*      m_band;                 // current job
+        int                         m_rows;
+        int                         m_bandRows;
+        int                         m_nextRow;
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run band over the rows of an image on the shared pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+inline void Parallel_For_Rows(int rows, const RowBandFunction& band, int min_rows = 8)
+{
+    ThreadPool::Instance().Parallel_For_Rows(rows, band, min_rows);
+}// Parallel_For_Rows
+
+#endif
@@ -48,6 +48,22 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TGA_SSE2
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#define TGA_MMAP
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define TGA_MMAP
+#endif
 
 #include "libtarga.h"
 
@@ -99,21 +115,77 @@
 #define TGA_ERR_BAD_DIMENSIONS          (11)
 
 
+#define TGA_READ_CHUNK                  (65536)     /* bytes the bulk decoder reads at a time, and the smallest file it maps */
+#define TGA_WRITE_CHUNK                 (262144)    /* bytes the encoders gather before writing */
+
+
+
+/* buffered reader for the bulk decoder, over a mapping of the file when there is one */
+typedef struct {
+    FILE * file;
+    ubyte * buf;
+    uint32 pos;
+    uint32 len;
+    void * map;                 /* the whole file, buf then points at the current position in it */
+    size_t map_bytes;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} tga_reader;
+
+
+/* run length packet carried from one row into the next */
+typedef struct {
+    uint32 left;                /* pixels still to come from the packet */
+    int raw;                    /* nonzero for a raw packet */
+    ubyte pix[4];               /* the repeated pixel of a run packet */
+} tga_packet;
+
+
 
 static uint32 TargaError;
 
+static ubyte tga_premultiplied[256][256];     /* [alpha][channel] as tga_convert_color premultiplies */
+static ubyte tga_unpremultiplied[256][256];   /* [alpha][channel] as the writers divide it back out */
+static int tga_tables_ready = 0;
+
 
 static int16 ttohs( int16 val );
 static int16 htots( int16 val );
 static int32 ttohl( int32 val );
-static int32 htotl( int32 val );
 
 
 static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
                             ubyte * colormap, ubyte cmap_bytes_entry );
 static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
 static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format );
+                                   uint32 w, uint32 h, uint32 pixel, uint32 format,
+                                   uint32 stride, int top_down );
+static const ubyte * tga_row_in_mem( const ubyte * dat, int row, int height, int stride, int top_down );
+
+static void tga_load_truecolor( FILE * tga, ubyte * dat, int rle, uint32 w, uint32 h, 
+                                ubyte bytes_per_pix, int opaque, ubyte img_spec, uint32 format,
+                                uint32 stride, int top_down );
+static void tga_reader_open( tga_reader * rd, FILE * file );
+static void tga_reader_close( tga_reader * rd );
+static uint32 tga_read_bytes( tga_reader * rd, ubyte * dst, uint32 count );
+static const ubyte * tga_next_bytes( tga_reader * rd, uint32 count );
+static void tga_read_rle_row( tga_reader * rd, tga_packet * packet, ubyte * row, 
+                              uint32 w, ubyte bytes_per_pix );
+static void tga_convert_row( const ubyte * in, ubyte * out, uint32 count, 
+                             ubyte bytes_per_pix, int opaque, uint32 format_out );
+static void tga_convert_pixels( const ubyte * in, ubyte * out, uint32 count, 
+                                ubyte bytes_per_pix, int opaque, uint32 format_out );
+static void tga_init_tables( void );
+static void tga_encode_row( const ubyte * in, ubyte * out, uint32 count, uint32 format );
+static void tga_encode_pixels( const ubyte * in, ubyte * out, uint32 count, uint32 format );
+static void tga_equal_neighbors( const ubyte * px, uint32 count, uint32 bytes_per_pix, ubyte * equal );
+static uint32 tga_pack_row( const ubyte * px, const ubyte * equal, ubyte * out, 
+                            uint32 count, uint32 bytes_per_pix );
+
+#ifdef TGA_SSE2
+static __m128i tga_swap_red_blue( __m128i p );
+#endif
 
 
 
@@ -202,6 +274,16 @@ void * tga_create( int width, int height, unsigned int format ) {
 /* loads and converts a targa from disk */
 void * tga_load( const char * filename, 
                 int * width, int * height, unsigned int format ) {
+
+    return( tga_load_layout( filename, width, height, format, NULL, NULL ) );
+
+}
+
+
+
+/* loads and converts a targa from disk into the given memory layout */
+void * tga_load_layout( const char * filename, int * width, int * height, unsigned int format,
+                        const tga_layout * layout, void * (*alloc)( size_t bytes ) ) {
     
     ubyte  idlen;               // length of the image_id string below.
     ubyte  cmap_type;           // paletted image <=> cmap_type
@@ -253,6 +335,9 @@ void * tga_load( const char * filename,
 
     ubyte packet_header = 0;
     ubyte repcount = 0;
+
+    uint32 stride = 0;
+    int top_down = layout ? layout->top_down : 0;
     
 
     switch( format ) {
@@ -423,16 +508,52 @@ void * tga_load( const char * filename,
     }
 
 
+    /* check the type before allocating, nothing fails past here */
+    switch( image_type ) {
+
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_UNC_PALETTED:
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
+        break;
+
+    default:
+        free( colormap );
+        fclose( targafile );
+        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
+        return( NULL );
+
+    }
+
+
     /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
+    stride = layout && layout->stride ? (uint32)layout->stride : img_spec_width * format;
+    bytes_total = stride * img_spec_height;
 
-    image_data = (ubyte *)malloc( bytes_total );
+    image_data = (ubyte *)(alloc ? alloc( bytes_total ) : malloc( bytes_total ));
 
     img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
 
     // compute the true number of bits per pixel
     true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
 
+    /* plain 24 and 32 bit truecolor stored from the left goes through the bulk decoder */
+    if( colormap == NULL && 
+        (image_type == TGA_IMG_UNC_TRUECOLOR || image_type == TGA_IMG_RLE_TRUECOLOR) &&
+        (img_spec_pix_depth == 24 || img_spec_pix_depth == 32) &&
+        ((img_spec_img_desc & 0x30) >> 4 == TGA_LOWER_LEFT || (img_spec_img_desc & 0x30) >> 4 == TGA_UPPER_LEFT) ) {
+
+        tga_load_truecolor( targafile, image_data, image_type == TGA_IMG_RLE_TRUECOLOR, 
+            img_spec_width, img_spec_height, bytes_per_pix, img_spec_pix_depth == 24 || alphabits == 0,
+            img_spec_img_desc, format, stride, top_down );
+
+        // nothing left for the pixel at a time decoder below
+        image_type = TGA_IMG_NODATA;
+
+    }
+
     switch( image_type ) {
 
     case TGA_IMG_UNC_TRUECOLOR:
@@ -449,7 +570,7 @@ void * tga_load( const char * filename,
             
             // now write the data out.
             tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                i, img_spec_width, img_spec_height, tmp_col, format );
+                i, img_spec_width, img_spec_height, tmp_col, format, stride, top_down );
 
         }
     
@@ -481,7 +602,7 @@ void * tga_load( const char * filename,
                 /* write all the data out */
                 for( j = 0; j < repcount; j++ ) {
                     tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
+                        i + j, img_spec_width, img_spec_height, tmp_col, format, stride, top_down );
                 }
 
                 i += repcount;
@@ -498,7 +619,7 @@ void * tga_load( const char * filename,
                     tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
                     
                     tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
-                        i + j, img_spec_width, img_spec_height, tmp_col, format );
+                        i + j, img_spec_width, img_spec_height, tmp_col, format, stride, top_down );
 
                 }
 
@@ -511,13 +632,9 @@ void * tga_load( const char * filename,
         break;
     
 
-    default:
-
-        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
-        return( NULL );
-
     }
 
+    free( colormap );
     fclose( targafile );
 
     *width  = img_spec_width;
@@ -533,19 +650,30 @@ void * tga_load( const char * filename,
 
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
+    return( tga_write_raw_layout( file, width, height, dat, format, NULL ) );
+
+}
+
+
+
+int tga_write_raw_layout( const char * file, int width, int height, const unsigned char * dat,
+                          unsigned int format, const tga_layout * layout ) {
+
     FILE * tga;
 
-    uint32 i, j;
+    int stride = layout && layout->stride ? layout->stride : (int)(width * format);
+    int top_down = layout ? layout->top_down : 0;
 
-    uint32 size = width * height;
+    int i;
 
-    float red, green, blue, alpha;
+    uint32 row_bytes = width * format;
+    uint32 chunk_bytes = row_bytes > TGA_WRITE_CHUNK ? row_bytes : TGA_WRITE_CHUNK;
+    uint32 used = 0;
+    ubyte * chunk = NULL;
 
     char id[] = "written with libtarga";
     ubyte idlen = 21;
     ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
     ubyte cmap_type = 0;
     ubyte img_type  = 2;  // 2 - uncompressed truecolor  10 - RLE truecolor
     uint16 xorigin  = 0;
@@ -602,103 +730,76 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
     // write image id.
     fwrite( &id, idlen, 1, tga );
 
-    // color correction -- data is in RGB, need BGR.
-    for( i = 0; i < size; i++ ) {
+    // color correction -- data is in RGB, need BGR.  whole rows are
+    // converted into the chunk, which goes out when the next row won't fit.
+    chunk = (ubyte *)malloc( chunk_bytes );
 
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[i*format+j] << (8 * j);
-        }
+    tga_init_tables();
 
-        switch( format ) {
+    for( i = 0; i < height; i++ ) {
 
-        case TGA_TRUECOLOR_24:
+        if( used + row_bytes > chunk_bytes ) {
+            fwrite( chunk, used, 1, tga );
+            used = 0;
+        }
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+        // rows go out bottom first, wherever they are in memory
+        tga_encode_row( tga_row_in_mem( (const ubyte *)dat, i, height, stride, top_down ), 
+                        chunk + used, width, format );
+        used += row_bytes;
 
-            pixbuf = htotl( pixbuf );
-            
-            fwrite( &pixbuf, 3, 1, tga );
+    }
 
-            break;
+    if( used ) {
+        fwrite( chunk, used, 1, tga );
+    }
 
-        case TGA_TRUECOLOR_32:
+    free( chunk );
 
-            /* need to un-premultiply alpha.. */
+    fclose( tga );
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+    return( 1 );
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+}
 
-            /* clamp to 1.0f */
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-           
-            fwrite( &pixbuf, 4, 1, tga );
 
-            break;
 
-        }
-
-    }
-
-    fclose( tga );
+int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
-    return( 1 );
+    return( tga_write_rle_layout( file, width, height, dat, format, NULL ) );
 
 }
 
 
 
-
-
-int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+int tga_write_rle_layout( const char * file, int width, int height, const unsigned char * dat,
+                          unsigned int format, const tga_layout * layout ) {
 
     FILE * tga;
 
-    uint32 i, j;
-    uint32 oc, nc;
-
-    enum RLE_STATE { INIT, NONE, RLP, RAWP };
+    int stride = layout && layout->stride ? layout->stride : (int)(width * format);
+    int top_down = layout ? layout->top_down : 0;
 
-    int state = INIT;
-
-    uint32 size = width * height;
+    int i;
 
     uint16 shortwidth = (uint16)width;
     uint16 shortheight = (uint16)height;
 
-    ubyte repcount;
-
-    float red, green, blue, alpha;
-
-    int idx, row, column;
+    // a row never takes more than its pixels plus a header per pixel
+    uint32 row_max = width * (format + 1);
+    uint32 chunk_bytes = row_max > TGA_WRITE_CHUNK ? row_max : TGA_WRITE_CHUNK;
+    uint32 used = 0;
+    ubyte * chunk = NULL;
 
-    // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    // have to buffer a whole line to find the runs in it.
+    ubyte * rowbuf = NULL;
+    ubyte * equal = NULL;
 
     char id[] = "written with libtarga";
     ubyte idlen = 21;
     ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
     ubyte cmap_type = 0;
     ubyte img_type  = 10;  // 2 - uncompressed truecolor  10 - RLE truecolor
     uint16 xorigin  = 0;
@@ -749,327 +850,666 @@ int tga_write_rle( const char * file, int width, int height, unsigned char * dat
     // write image id.
     fwrite( &id, idlen, 1, tga );
 
-    // initial color values -- just to shut up the compiler.
-    nc = 0;
+    rowbuf = (ubyte *)malloc( width * format );
+    equal = (ubyte *)malloc( width );
+    chunk = (ubyte *)malloc( chunk_bytes );
+
+    tga_init_tables();
 
     // color correction -- data is in RGB, need BGR.
-    // also run-length-encoding.
-    for( i = 0; i < size; i++ ) {
+    // also run-length-encoding, packets stop at the end of each row.
+    for( i = 0; i < height; i++ ) {
 
-        idx = i * format;
+        if( used + row_max > chunk_bytes ) {
+            fwrite( chunk, used, 1, tga );
+            used = 0;
+        }
 
-        row = i / width;
-        column = i % width;
+        // rows go out bottom first, wherever they are in memory
+        tga_encode_row( tga_row_in_mem( (const ubyte *)dat, i, height, stride, top_down ), 
+                        rowbuf, width, format );
+        tga_equal_neighbors( rowbuf, width, format, equal );
+        used += tga_pack_row( rowbuf, equal, chunk + used, width, format );
 
-        //printf( "row: %d, col: %d\n", row, column );
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[idx+j] << (8 * j);
-        }
+    }
 
-        switch( format ) {
+    if( used ) {
+        fwrite( chunk, used, 1, tga );
+    }
 
-        case TGA_TRUECOLOR_24:
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    // close the file.
+    fclose( tga );
 
-            pixbuf = htotl( pixbuf );
-            break;
+    free( chunk );
+    free( equal );
+    free( rowbuf );
 
-        case TGA_TRUECOLOR_32:
+    return( 1 );
 
-            /* need to un-premultiply alpha.. */
+}
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
 
-            /* clamp to 1.0f */
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-            break;
 
-        }
+/*************************************************************************************************/
 
 
-        oc = nc;
 
-        nc = pixbuf;
 
 
-        switch( state ) {
 
-        case INIT:
-            // this is just used to make sure we have 2 pixel values to consider.
-            state = NONE;
-            break;
 
+static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
+                                   uint32 w, uint32 h, uint32 pixel, uint32 format,
+                                   uint32 stride, int top_down ) {
 
-        case NONE:
+    // write the pixel to the data regarding how the
+    // header says the data is ordered.
 
-            if( column == 0 ) {
-                // write a 1 pixel raw packet for the old pixel, then go thru again.
-                repcount = 0;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+    uint32 j;
+    uint32 x, y;
+    uint32 addy;
 
-            if( nc == oc ) {
-                repcount = 0;
-                state = RLP;
-            } else {
-                repcount = 0;
-                state = RAWP;
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    switch( (img_spec & 0x30) >> 4 ) {
+
+    case TGA_LOWER_RIGHT:
+        x = w - 1 - (number % w);
+        y = number / h;
+        break;
+
+    case TGA_UPPER_LEFT:
+        x = number % w;
+        y = h - 1 - (number / w);
+        break;
+
+    case TGA_UPPER_RIGHT:
+        x = w - 1 - (number % w);
+        y = h - 1 - (number / w);
+        break;
+
+    case TGA_LOWER_LEFT:
+    default:
+        x = number % w;
+        y = number / w;
+        break;
+
+    }
+
+    // y counts up from the bottom, memory may not
+    if( top_down ) {
+        y = h - 1 - y;
+    }
+
+    addy = y * stride + x * format;
+    for( j = 0; j < format; j++ ) {
+        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    }
+    
+}
+
+
+
+
+/* start of row 'row', counted from the bottom, in memory of the given layout */
+static const ubyte * tga_row_in_mem( const ubyte * dat, int row, int height, int stride, int top_down ) {
+
+    return( dat + (top_down ? height - 1 - row : row) * stride );
+
+}
+
+
+
+
+/* 
+    Bulk decoder for 24 and 32 bit truecolor, raw or run length encoded.
+    The file is mapped, or read a chunk at a time, and each row is expanded
+    into a staging row of file pixels, then converted into memory in one 
+    pass.  Raw rows that sit whole in the mapping or chunk are converted 
+    from there.  Decodes exactly what the pixel at a time path does, 
+    including the black pixels a short file leaves at the end.
+*/
+static void tga_load_truecolor( FILE * tga, ubyte * dat, int rle, uint32 w, uint32 h, 
+                                ubyte bytes_per_pix, int opaque, ubyte img_spec, uint32 format,
+                                uint32 stride, int top_down ) {
+
+    tga_reader rd;
+    tga_packet packet;
+
+    ubyte * row = NULL;
+    const ubyte * src = NULL;
+    uint32 row_bytes = w * bytes_per_pix;
+    uint32 got = 0;
+    uint32 i;
+
+    int upper = ((img_spec & 0x30) >> 4) == TGA_UPPER_LEFT;
+
+    tga_init_tables();
+
+    tga_reader_open( &rd, tga );
+
+    packet.left = 0;
+    packet.raw = 0;
+
+    row = (ubyte *)malloc( row_bytes );
+
+    for( i = 0; i < h; i++ ) {
+
+        src = row;
+
+        if( rle ) {
+            tga_read_rle_row( &rd, &packet, row, w, bytes_per_pix );
+        } else if( (src = tga_next_bytes( &rd, row_bytes )) == NULL ) {
+            // only whole pixels count, the rest of the row reads as zero
+            got = tga_read_bytes( &rd, row, row_bytes );
+            got -= got % bytes_per_pix;
+            memset( row + got, 0, row_bytes - got );
+            src = row;
+        }
+
+        // file rows count up from the bottom unless the origin is at the top
+        tga_convert_row( src, (ubyte *)tga_row_in_mem( dat, upper ? h - 1 - i : i, h, stride, top_down ), 
+                         w, bytes_per_pix, opaque, format );
+
+    }
+
+    free( row );
+    tga_reader_close( &rd );
+
+}
+
+
+
+
+/* 
+    Start reading at the file's current position.  Files of a chunk or 
+    more are mapped read only, so the payload is never copied through 
+    stdio; the buffer is for small files and wherever mapping fails.
+*/
+static void tga_reader_open( tga_reader * rd, FILE * file ) {
+
+    long offset = ftell( file );
+
+    rd->file = file;
+    rd->buf = NULL;
+    rd->pos = 0;
+    rd->len = 0;
+    rd->map = NULL;
+    rd->map_bytes = 0;
+
+#if defined(TGA_MMAP) && defined(_WIN32)
+    {
+        HANDLE handle = (HANDLE)_get_osfhandle( _fileno( file ) );
+        LARGE_INTEGER size;
+
+        rd->mapping = NULL;
+        if( offset >= 0 && GetFileSizeEx( handle, &size ) && 
+            size.QuadPart >= TGA_READ_CHUNK && size.QuadPart <= 0xFFFFFFFF ) {
+            rd->mapping = CreateFileMapping( handle, NULL, PAGE_READONLY, 0, 0, NULL );
+            if( rd->mapping != NULL ) {
+                rd->map = MapViewOfFile( rd->mapping, FILE_MAP_READ, 0, 0, 0 );
+                rd->map_bytes = (size_t)size.QuadPart;
+                if( rd->map == NULL ) {
+                    CloseHandle( rd->mapping );
+                    rd->mapping = NULL;
                 }
             }
-            break;
+        }
+    }
+#elif defined(TGA_MMAP)
+    {
+        struct stat info;
+
+        if( offset >= 0 && fstat( fileno( file ), &info ) == 0 && 
+            info.st_size >= TGA_READ_CHUNK && info.st_size <= 0xFFFFFFFF ) {
+            rd->map = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileno( file ), 0 );
+            rd->map_bytes = (size_t)info.st_size;
+            if( rd->map == MAP_FAILED ) {
+                rd->map = NULL;
+            }
+#ifdef MADV_SEQUENTIAL
+            else {
+                madvise( rd->map, rd->map_bytes, MADV_SEQUENTIAL );
+            }
+#endif
+        }
+    }
+#endif
+
+    if( rd->map != NULL && (size_t)offset <= rd->map_bytes ) {
+        rd->buf = (ubyte *)rd->map + offset;
+        rd->len = (uint32)(rd->map_bytes - offset);
+    } else {
+        tga_reader_close( rd );
+        rd->buf = (ubyte *)malloc( TGA_READ_CHUNK );
+    }
 
+}
 
-        case RLP:
-            repcount++;
 
-            if( column == 0 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
+
+
+static void tga_reader_close( tga_reader * rd ) {
+
+    if( rd->map != NULL ) {
+#if defined(TGA_MMAP) && defined(_WIN32)
+        UnmapViewOfFile( rd->map );
+        CloseHandle( rd->mapping );
+#elif defined(TGA_MMAP)
+        munmap( rd->map, rd->map_bytes );
 #endif
-                state = NONE;
+        rd->map = NULL;
+    } else {
+        free( rd->buf );
+    }
+
+    rd->buf = NULL;
+
+}
+
+
+
+
+/* count bytes in place if the mapping or chunk holds them all, NULL if it doesn't */
+static const ubyte * tga_next_bytes( tga_reader * rd, uint32 count ) {
+
+    const ubyte * p = rd->buf + rd->pos;
+
+    if( rd->len - rd->pos < count ) {
+        return( NULL );
+    }
+
+    rd->pos += count;
+    return( p );
+
+}
+
+
+
+
+/* copy up to count bytes from the file, returns how many there were */
+static uint32 tga_read_bytes( tga_reader * rd, ubyte * dst, uint32 count ) {
+
+    uint32 done = 0;
+    uint32 n;
+
+    while( done < count ) {
+
+        if( rd->pos == rd->len ) {
+            // a mapping already holds the rest of the file
+            if( rd->map != NULL ) {
                 break;
             }
-
-            if( repcount == 127 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
+            rd->len = (uint32)fread( rd->buf, 1, TGA_READ_CHUNK, rd->file );
+            rd->pos = 0;
+            if( rd->len == 0 ) {
                 break;
             }
+        }
 
-            if( nc != oc ) {
-                // finish off rlp
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-            }
-            break;
+        n = rd->len - rd->pos;
+        if( n > count - done ) {
+            n = count - done;
+        }
 
+        memcpy( dst + done, rd->buf + rd->pos, n );
+        rd->pos += n;
+        done += n;
 
-        case RAWP:
-            repcount++;
+    }
 
-            if( column == 0 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
+    return( done );
+
+}
+
+
+
+
+/* expand one row of run length packets, a packet may carry over into the next row */
+static void tga_read_rle_row( tga_reader * rd, tga_packet * packet, ubyte * row, 
+                              uint32 w, ubyte bytes_per_pix ) {
+
+    ubyte header;
+    uint32 x = 0;
+    uint32 n, got, j;
+
+    while( x < w ) {
+
+        if( packet->left == 0 ) {
+
+            // past the end, the pixel path reads a raw packet of two black pixels
+            if( tga_read_bytes( rd, &header, 1 ) < 1 ) {
+                header = 1;
             }
 
-            if( repcount == 127 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+            packet->raw = !(header & 0x80);
+            packet->left = (header & 0x7F) + 1;
+
+            if( !packet->raw ) {
+                if( tga_read_bytes( rd, packet->pix, bytes_per_pix ) < bytes_per_pix ) {
+                    memset( packet->pix, 0, sizeof( packet->pix ) );
                 }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
             }
 
-            if( nc == oc ) {
-                // finish off rawp
-                repcount--;
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                
-                // start new rlp
-                repcount = 0;
-                state = RLP;
-                break;
+        }
+
+        n = packet->left < w - x ? packet->left : w - x;
+
+        if( packet->raw ) {
+            got = tga_read_bytes( rd, row + x * bytes_per_pix, n * bytes_per_pix );
+            got -= got % bytes_per_pix;
+            memset( row + x * bytes_per_pix + got, 0, n * bytes_per_pix - got );
+        } else {
+            for( j = 0; j < n; j++ ) {
+                memcpy( row + (x + j) * bytes_per_pix, packet->pix, bytes_per_pix );
             }
+        }
 
-            // continue making rawp
-            for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+        packet->left -= n;
+        x += n;
+
+    }
+
+}
+
+
+
+
+/* 
+    BGR(A) file pixels to premultiplied RGB(A) in memory, the same values
+    tga_convert_color gives.  Opaque pixels only swap red and blue; the 
+    others look their channels up in the premultiplied table.
+*/
+static void tga_convert_row( const ubyte * in, ubyte * out, uint32 count, 
+                             ubyte bytes_per_pix, int opaque, uint32 format_out ) {
+
+    uint32 i = 0;
+
+#ifdef TGA_SSE2
+    // four pixels at a time while they are all opaque
+    if( bytes_per_pix == 4 && format_out == TGA_TRUECOLOR_32 ) {
+
+        const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+
+        for( ; i + 4 <= count; i += 4 ) {
+
+            __m128i p = _mm_loadu_si128( (const __m128i *)(in + i * 4) );
+
+            if( opaque ) {
+                p = _mm_or_si128( p, alpha );
+            } else if( _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( p, alpha ), alpha ) ) != 0xFFFF ) {
+                tga_convert_pixels( in + i * 4, out + i * 4, 4, bytes_per_pix, opaque, format_out );
+                continue;
             }
 
-            break;
+            _mm_storeu_si128( (__m128i *)(out + i * 4), tga_swap_red_blue( p ) );
 
         }
-       
 
     }
+#endif
 
+    tga_convert_pixels( in + i * bytes_per_pix, out + i * format_out, count - i, 
+                        bytes_per_pix, opaque, format_out );
 
-    // clean up state.
+}
 
-    switch( state ) {
 
-    case INIT:
-        break;
 
-    case NONE:
-        // write the last 2 pixels in a raw packet.
-        fwrite( &one, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&nc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &nc, format, 1, tga );
-#endif
-        break;
 
-    case RLP:
-        repcount++;
-        repcount |= 0x80;
-        fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-        break;
+static void tga_convert_pixels( const ubyte * in, ubyte * out, uint32 count, 
+                                ubyte bytes_per_pix, int opaque, uint32 format_out ) {
 
-    case RAWP:
-        repcount++;
-        for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-            rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-            rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
+    uint32 i;
+    ubyte a;
+
+    for( i = 0; i < count; i++ ) {
+
+        const ubyte * s = in + i * bytes_per_pix;
+        ubyte * d = out + i * format_out;
+
+        a = opaque ? 255 : s[3];
+
+        if( a == 255 ) {
+            d[0] = s[2];
+            d[1] = s[1];
+            d[2] = s[0];
+        } else {
+            d[0] = tga_premultiplied[a][s[2]];
+            d[1] = tga_premultiplied[a][s[1]];
+            d[2] = tga_premultiplied[a][s[0]];
+        }
+
+        if( format_out == TGA_TRUECOLOR_32 ) {
+            d[3] = a;
         }
-        fwrite( &repcount, 1, 1, tga );
-        fwrite( rawbuf, (repcount + 1) * 3, 1, tga );
-        break;
 
     }
 
+}
 
-    // close the file.
-    fclose( tga );
 
-    free( rawbuf );
 
-    return( 1 );
+
+#ifdef TGA_SSE2
+/* swap bytes 0 and 2 of each of the four pixels, BGRA <-> RGBA */
+static __m128i tga_swap_red_blue( __m128i p ) {
+
+    const __m128i keep = _mm_set1_epi32( (int)0xFF00FF00 );
+    const __m128i low = _mm_set1_epi32( 0x000000FF );
+
+    return( _mm_or_si128( _mm_and_si128( p, keep ),
+        _mm_or_si128( _mm_slli_epi32( _mm_and_si128( p, low ), 16 ),
+                      _mm_and_si128( _mm_srli_epi32( p, 16 ), low ) ) ) );
 
 }
+#endif
 
 
 
 
+/* build the premultiply and un-premultiply tables the bulk paths look up */
+static void tga_init_tables( void ) {
 
+    uint32 a, c;
+    float value, alpha;
 
-/*************************************************************************************************/
+    if( tga_tables_ready ) {
+        return;
+    }
 
+    for( a = 0; a < 256; a++ ) {
+        for( c = 0; c < 256; c++ ) {
 
+            // as tga_convert_color multiplies
+            tga_premultiplied[a][c] = (ubyte)(((float)c / 255.0f) * ((float)a / 255.0f) * 255.0f);
 
+            // and as the writers always divided
+            value = c / 255.0f;
+            alpha = a / 255.0f;
+            if( alpha > 0.0001 ) {
+                value /= alpha;
+            }
+            tga_unpremultiplied[a][c] = (ubyte)(value > 1.0f ? 255.0f : value * 255.0f);
 
+        }
+    }
 
+    tga_tables_ready = 1;
+
+}
 
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
 
+/* 
+    Premultiplied RGB(A) in memory to straight BGR(A) file pixels.  Like
+    loading, opaque pixels only swap red and blue.
+*/
+static void tga_encode_row( const ubyte * in, ubyte * out, uint32 count, uint32 format ) {
+
+    uint32 i = 0;
+
+#ifdef TGA_SSE2
+    // four pixels at a time while they are all opaque
+    if( format == TGA_TRUECOLOR_32 ) {
+
+        const __m128i alpha = _mm_set1_epi32( (int)0xFF000000 );
+
+        for( ; i + 4 <= count; i += 4 ) {
+
+            __m128i p = _mm_loadu_si128( (const __m128i *)(in + i * 4) );
+
+            if( _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( p, alpha ), alpha ) ) != 0xFFFF ) {
+                tga_encode_pixels( in + i * 4, out + i * 4, 4, format );
+                continue;
+            }
+
+            _mm_storeu_si128( (__m128i *)(out + i * 4), tga_swap_red_blue( p ) );
+
+        }
+
+    }
+#endif
+
+    tga_encode_pixels( in + i * format, out + i * format, count - i, format );
+
+}
+
+
+
+
+static void tga_encode_pixels( const ubyte * in, ubyte * out, uint32 count, uint32 format ) {
+
+    uint32 i;
+    ubyte a;
+
+    for( i = 0; i < count; i++ ) {
+
+        const ubyte * s = in + i * format;
+        ubyte * d = out + i * format;
+
+        a = format == TGA_TRUECOLOR_32 ? s[3] : 255;
+
+        if( a == 255 ) {
+            d[0] = s[2];
+            d[1] = s[1];
+            d[2] = s[0];
+        } else {
+            d[0] = tga_unpremultiplied[a][s[2]];
+            d[1] = tga_unpremultiplied[a][s[1]];
+            d[2] = tga_unpremultiplied[a][s[0]];
+        }
+
+        if( format == TGA_TRUECOLOR_32 ) {
+            d[3] = a;
+        }
+
+    }
+
+}
+
+
+
+
+/* equal[k] is 1 when pixel k matches pixel k + 1, the last entry is 0 */
+static void tga_equal_neighbors( const ubyte * px, uint32 count, uint32 bytes_per_pix, ubyte * equal ) {
+
+    uint32 k = 0;
     uint32 j;
-    uint32 x, y;
-    uint32 addy;
+    int mask;
 
-    switch( (img_spec & 0x30) >> 4 ) {
+    if( count == 0 ) {
+        return;
+    }
 
-    case TGA_LOWER_RIGHT:
-        x = w - 1 - (number % w);
-        y = number / h;
-        break;
+#ifdef TGA_SSE2
+    if( bytes_per_pix == 4 ) {
 
-    case TGA_UPPER_LEFT:
-        x = number % w;
-        y = h - 1 - (number / w);
-        break;
+        // four neighbor pairs per compare
+        for( ; k + 5 <= count; k += 4 ) {
+            __m128i a = _mm_loadu_si128( (const __m128i *)(px + k * 4) );
+            __m128i b = _mm_loadu_si128( (const __m128i *)(px + k * 4 + 4) );
+            mask = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( a, b ) ) );
+            for( j = 0; j < 4; j++ ) {
+                equal[k + j] = (ubyte)((mask >> j) & 1);
+            }
+        }
 
-    case TGA_UPPER_RIGHT:
-        x = w - 1 - (number % w);
-        y = h - 1 - (number / w);
-        break;
+    } else {
 
-    case TGA_LOWER_LEFT:
-    default:
-        x = number % w;
-        y = number / w;
-        break;
+        // five, a pair matches when all three of its bytes do
+        for( ; k * 3 + 19 <= count * 3; k += 5 ) {
+            __m128i a = _mm_loadu_si128( (const __m128i *)(px + k * 3) );
+            __m128i b = _mm_loadu_si128( (const __m128i *)(px + k * 3 + 3) );
+            mask = _mm_movemask_epi8( _mm_cmpeq_epi8( a, b ) );
+            for( j = 0; j < 5; j++ ) {
+                equal[k + j] = ((mask >> (j * 3)) & 7) == 7;
+            }
+        }
 
     }
+#endif
 
-    addy = (y * w + x) * format;
-    for( j = 0; j < format; j++ ) {
-        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    for( ; k + 1 < count; k++ ) {
+        const ubyte * p = px + k * bytes_per_pix;
+        equal[k] = p[0] == p[bytes_per_pix] && p[1] == p[bytes_per_pix + 1] && p[2] == p[bytes_per_pix + 2] &&
+                   (bytes_per_pix == 3 || p[3] == p[7]);
     }
-    
+
+    equal[count - 1] = 0;
+
+}
+
+
+
+
+/* 
+    Run length encode one row of file pixels, returns the bytes written.
+    Two or more equal pixels make a run packet, anything else goes in a 
+    raw packet that stops where the next run starts.
+*/
+static uint32 tga_pack_row( const ubyte * px, const ubyte * equal, ubyte * out, 
+                            uint32 count, uint32 bytes_per_pix ) {
+
+    ubyte * o = out;
+    const ubyte * stop;
+    uint32 x = 0;
+    uint32 n, limit;
+
+    while( x < count ) {
+
+        if( equal[x] ) {
+
+            n = 2;
+            while( n < 128 && x + n < count && equal[x + n - 1] ) {
+                n++;
+            }
+
+            *o++ = (ubyte)(0x80 | (n - 1));
+            memcpy( o, px + x * bytes_per_pix, bytes_per_pix );
+            o += bytes_per_pix;
+
+        } else {
+
+            limit = count - x < 128 ? count - x : 128;
+            stop = (const ubyte *)memchr( equal + x + 1, 1, limit - 1 );
+            n = stop ? (uint32)(stop - (equal + x)) : limit;
+
+            *o++ = (ubyte)(n - 1);
+            memcpy( o, px + x * bytes_per_pix, n * bytes_per_pix );
+            o += n * bytes_per_pix;
+
+        }
+
+        x += n;
+
+    }
+
+    return( (uint32)(o - out) );
+
 }
 
 
@@ -1245,17 +1685,3 @@ static int32 ttohl( int32 val ) {
 #endif 
 
 }
-
-
-static int32 htotl( int32 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0x000000FF) << 24) +
-            ((val & 0x0000FF00) << 8)  +
-            ((val & 0x00FF0000) >> 8)  +
-            ((val & 0xFF000000) >> 24) );
-#else
-    return( val );
-#endif 
-
-}
@@ -1,6 +1,8 @@
 #ifndef _libtarga_h_
 #define _libtarga_h_
 
+#include <stddef.h>
+
 /**************************************************************************
  ** Simplified TARGA library for Intro to Graphics Classes
  **
@@ -104,6 +106,20 @@
 */
 
 
+/*
+   Unless a layout says otherwise.  The _layout calls take one to read or
+   write images kept some other way -- top row first, or with padded rows --
+   and flip or skip rows as the pixels go through, so there's no need for a
+   second copy.  A NULL layout is the default: bottom row first, rows
+   packed width * format bytes apart.
+*/
+
+typedef struct {
+    int top_down;       /* nonzero if the first row in memory is the top of the image */
+    int stride;         /* bytes from the start of one row to the next, 0 for width * format */
+} tga_layout;
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -118,11 +134,20 @@ const char *    tga_error_string( int error_code );
 void * tga_create( int width, int height, unsigned int format );
 void * tga_load( const char * file, int * width, int * height, unsigned int format );
 
+/* alloc gets the image buffer (stride * height bytes); NULL means malloc */
+void * tga_load_layout( const char * file, int * width, int * height, unsigned int format,
+                        const tga_layout * layout, void * (*alloc)( size_t bytes ) );
+
 
 /* Writing images to file  --  a return of 1 indicates success, 0 indicates error*/
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format );
 
+int tga_write_raw_layout( const char * file, int width, int height, const unsigned char * dat,
+                          unsigned int format, const tga_layout * layout );
+int tga_write_rle_layout( const char * file, int width, int height, const unsigned char * dat,
+                          unsigned int format, const tga_layout * layout );
+
 
 
 #ifdef __cplusplus
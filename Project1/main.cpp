@@ -19,17 +19,20 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Window.h>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sThreads[]        = "-threads";           // worker thread count command line switch
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -61,11 +64,18 @@ void DisplayNames()
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Argument processing callback. Does nothing at this point.
+//      Argument processing callback.  Consumes "-threads N" so FLTK does not
+//  reject it; the value is applied in main.
 //
 ///////////////////////////////////////////////////////////////////////////////
 static int Arg_Callback(int argc, char *argv[], int &i)
 {
+    if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)
+    {
+        i += 2;
+        return 2;
+    }// if
+
     return 0;
 }// Arg_Callback
 
@@ -103,13 +113,15 @@ int main(int argc, char *argv[])
     {
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)          // set worker thread count
+            ThreadPool::Instance().Set_Thread_Count(atoi(argv[++i]));
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-threads count] [-headless scriptFilenames . . .]" << endl;
             return 0;
         }// else
     }// for
@@ -0,0 +1,126 @@
+#! /bin/sh
+
+# Replay the cases of regress.txt headless, check each result against its
+# golden image in result/ and time each command.  With a baseline file of
+# "<case> <MP/s>" lines, a case also fails when its throughput falls more
+# than the allowed percentage below the baseline; -w writes the baseline
+# from this run instead.  Each case is also run on one thread and on
+# several, which have to give the same pixels.  Paths are taken from this
+# directory.
+
+usage()
+{
+  echo "usage: $0 [-p program] [-r runs] [-b baseline] [-s slowdown%] [-t threads] [-w] [cases file]"
+  exit 1
+}
+
+cd `dirname $0` || exit 1
+
+program=./Project1
+runs=10
+baseline=regress-baseline.txt
+slowdown=25
+threads=4
+write=0
+
+while getopts p:r:b:s:t:w option
+do
+  case $option in
+    p) program=$OPTARG ;;
+    r) runs=$OPTARG ;;
+    b) baseline=$OPTARG ;;
+    s) slowdown=$OPTARG ;;
+    t) threads=$OPTARG ;;
+    w) write=1 ;;
+    *) usage ;;
+  esac
+done
+shift `expr $OPTIND - 1`
+cases=${1:-regress.txt}
+
+script=/tmp/regress.$$.txt
+results=/tmp/regress.$$.out
+image=/tmp/regress.$$.tga
+trap 'rm -f $script $results $results.baseline $image $image.1' 0
+
+if [ $write -eq 1 ]
+then
+  : > $results.baseline
+fi
+
+failed=0
+passed=0
+
+while read name input tolerance command
+do
+  case $name in
+    ''|'#'*) continue ;;
+  esac
+  golden=${name#*=}
+  name=${name%%=*}
+
+  # scripts need a line after the last command
+  printf 'load images/%s.tga\ntime %s %s\nmetrics result/%s.tga\nend\n' \
+    "$input" "$runs" "$command" "$golden" > $script
+  $program -headless $script > $results 2>&1 < /dev/null
+
+  mps=`sed -n 's/^time .* mps=\([0-9.]*\).*/\1/p' $results`
+  psnr=`sed -n 's/^metrics .* psnr=\([0-9.inf]*\).*/\1/p' $results`
+  mismatched=`sed -n 's/^metrics .* mismatched=\([0-9]*\).*/\1/p' $results`
+  expected=`awk -v g="$name" '$1 == g { print $2 }' $baseline 2> /dev/null`
+
+  status=PASS
+  note=""
+  if [ -z "$mps" ]
+  then
+    status=FAIL
+    note="`grep -v '^Unable to parse command: end' $results | head -1`"
+  else
+    case $tolerance in
+      none)
+        ;;
+      exact)
+        [ "$mismatched" = 0 ] || { status=FAIL; note="${mismatched:-no} pixels differ"; } ;;
+      *)
+        [ -n "$psnr" ] && awk -v p="$psnr" -v t="$tolerance" 'BEGIN { exit !(p == "inf" || p + 0 >= t + 0) }' ||
+          { status=FAIL; note="psnr ${psnr:-none} below $tolerance"; } ;;
+    esac
+
+    if [ $status = PASS ] && [ $threads -gt 1 ]
+    then
+      # both results go through a file, saving translucent pixels loses a little
+      printf 'threads 1\nload images/%s.tga\n%s\nsave %s.1\nthreads %s\nload images/%s.tga\n%s\nsave %s\nload %s\nmetrics %s.1\nend\n' \
+        "$input" "$command" $image "$threads" "$input" "$command" $image $image $image > $script
+      $program -headless $script > $results 2>&1 < /dev/null
+
+      differ=`sed -n 's/^metrics .* mismatched=\([0-9]*\).*/\1/p' $results`
+      [ "$differ" = 0 ] || { status=FAIL; note="${differ:-no} pixels differ on $threads threads"; }
+    fi
+
+    if [ $write -eq 1 ]
+    then
+      echo "$name $mps" >> $results.baseline
+    elif [ -n "$expected" ] && [ $status = PASS ] &&
+      awk -v m="$mps" -v e="$expected" -v s="$slowdown" 'BEGIN { exit !(m < e * (100 - s) / 100) }'
+    then
+      status=FAIL
+      note="$mps MP/s, baseline $expected"
+    fi
+  fi
+
+  printf '%s  %-32s %10s MP/s  psnr %-8s %s\n' $status "$name" "${mps:--}" "${psnr:--}" "$note"
+  if [ $status = PASS ]
+  then
+    passed=`expr $passed + 1`
+  else
+    failed=`expr $failed + 1`
+  fi
+done < $cases
+
+if [ $write -eq 1 ]
+then
+  cp $results.baseline $baseline
+fi
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]